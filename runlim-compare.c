@@ -0,0 +1,717 @@
+// Compares sets of 'runlim' results of benchmark campaigns.
+
+#define _GNU_SOURCE /* for 'getline' and 'nftw' flags */
+
+#include <assert.h>
+#include <ftw.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/*------------------------------------------------------------------------*/
+
+#define PAR 2.0
+#define SUFFIX ".log"
+#define NO_LIMIT 311040000.0 /* default time limit of 'runlim' */
+
+/*------------------------------------------------------------------------*/
+
+#define USAGE                                                                  \
+  "usage: runlim-compare [option ...] <set> <set> ...\n"                       \
+  "\n"                                                                         \
+  "where option is from the following list:\n"                                 \
+  "\n"                                                                         \
+  "  -h | --help                print this command line summary\n"             \
+  "\n"                                                                         \
+  "  --par=<number>             penalty factor of PAR score (default %g)\n"    \
+  "  --time-limit=<number>      time limit in seconds (default from logs)\n"   \
+  "  --real                     compare real time instead of process time\n"   \
+  "  --results=<list>           results counted as solved "                    \
+  "(e.g. '10,20')\n"                                                           \
+  "  --suffix=<suffix>          stripped from log file names "                 \
+  "(default '%s')\n"                                                           \
+  "\n"                                                                         \
+  "  --instances                list times of all instances and speedups\n"    \
+  "  --cactus=<file>            write cactus plot data to <file>\n"            \
+  "  --summary                  print summary lines of a single set\n"         \
+  "\n"                                                                         \
+  "A set is a directory of 'runlim' log files (the instance name is the\n"     \
+  "path relative to the directory without suffix) or a file with summary\n"    \
+  "lines as printed by '--summary' (tab separated instance, status,\n"         \
+  "result, time, real time, space, time limit and real time limit).\n"         \
+  "Runs with status 'ok' are solved (restricted by '--results').\n"            \
+  "Unsolved and missing runs are counted with the time limit (with\n"          \
+  "'--real' the smaller of both limits) multiplied by the PAR factor.\n"       \
+  "Without '--time-limit' all runs need to have the same time limit.\n"
+
+/*------------------------------------------------------------------------*/
+
+typedef struct Entry Entry;
+typedef struct Instance Instance;
+typedef struct Record Record;
+typedef struct Set Set;
+
+enum { MISSING = 0, SOLVED = 1, UNSOLVED = 2 };
+
+// Per set result of an instance.
+
+struct Entry {
+  float time;
+  char state;
+};
+
+struct Instance {
+  char *name;
+  Entry entries[];
+};
+
+// Parsed from a log file or summary line.
+
+struct Record {
+  char status[32];
+  int result;
+  double time;
+  double real;
+  double space;
+  double limit;
+  double real_limit;
+};
+
+struct Set {
+  const char *path;
+  long solved;
+  long unsolved;
+  long missing;
+  long faster;
+  long slower;
+  long compared;
+  double log_speedup;
+  double time;
+  double par;
+};
+
+/*------------------------------------------------------------------------*/
+
+static double par = PAR;
+static double time_limit;
+static int use_real;
+static int *results;
+static size_t num_results;
+static const char *suffix = SUFFIX;
+static int list_instances;
+static const char *cactus_path;
+static int summary;
+
+static Set *sets;
+static size_t num_sets;
+static size_t current_set;
+
+static Instance **instances;
+static size_t num_instances;
+static size_t size_instances;
+
+static size_t set_path_length;
+static long records;
+
+static double min_limit = -1;
+static double max_limit;
+
+/*------------------------------------------------------------------------*/
+
+static void error(const char *fmt, ...) {
+  va_list ap;
+  fputs("runlim-compare error: ", stderr);
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  fputc('\n', stderr);
+  va_end(ap);
+  exit(1);
+}
+
+static void warning(const char *fmt, ...) {
+  va_list ap;
+  fputs("runlim-compare warning: ", stderr);
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  fputc('\n', stderr);
+  va_end(ap);
+}
+
+/*------------------------------------------------------------------------*/
+
+// FNV-1a hash of instance names for the open addressing hash table.
+
+static size_t hash_name(const char *name) {
+  size_t res = 14695981039346656037ull;
+  const unsigned char *p;
+  for (p = (const unsigned char *)name; *p; p++)
+    res = (res ^ *p) * 1099511628211ull;
+  return res;
+}
+
+static size_t instance_bytes(void) {
+  return sizeof(Instance) + num_sets * sizeof(Entry);
+}
+
+static void resize_instances(void) {
+  Instance **old = instances;
+  size_t old_size = size_instances;
+  size_t i, pos;
+
+  size_instances = old_size ? 2 * old_size : 1024;
+  instances = calloc(size_instances, sizeof *instances);
+  if (!instances)
+    error("out-of-memory resizing instance table");
+
+  for (i = 0; i < old_size; i++) {
+    if (!old[i])
+      continue;
+    pos = hash_name(old[i]->name) & (size_instances - 1);
+    while (instances[pos])
+      pos = (pos + 1) & (size_instances - 1);
+    instances[pos] = old[i];
+  }
+  free(old);
+}
+
+static Instance *find_instance(const char *name) {
+  Instance *res;
+  size_t pos;
+
+  if (2 * (num_instances + 1) > size_instances)
+    resize_instances();
+
+  pos = hash_name(name) & (size_instances - 1);
+  while ((res = instances[pos])) {
+    if (!strcmp(res->name, name))
+      return res;
+    pos = (pos + 1) & (size_instances - 1);
+  }
+
+  res = calloc(1, instance_bytes());
+  if (!res || !(res->name = strdup(name)))
+    error("out-of-memory adding instance '%s'", name);
+  instances[pos] = res;
+  num_instances++;
+
+  return res;
+}
+
+/*------------------------------------------------------------------------*/
+
+static int solved(const Record *record) {
+  size_t i;
+  if (strcmp(record->status, "ok"))
+    return 0;
+  if (!num_results)
+    return 1;
+  for (i = 0; i < num_results; i++)
+    if (results[i] == record->result)
+      return 1;
+  return 0;
+}
+
+static void add_record(const char *name, const Record *record) {
+  Instance *instance;
+  Entry *entry;
+  double limit;
+
+  records++;
+
+  if (summary) {
+    printf("%s\t%s\t%d\t%.2f\t%.2f\t%.0f\t%.0f\t%.0f\n", name,
+	   record->status, record->result, record->time, record->real,
+	   record->space, record->limit, record->real_limit);
+    return;
+  }
+
+  instance = find_instance(name);
+  entry = instance->entries + current_set;
+
+  if (entry->state != MISSING)
+    warning("instance '%s' occurs twice in '%s'", name,
+	    sets[current_set].path);
+
+  entry->time = use_real ? record->real : record->time;
+  entry->state = solved(record) ? SOLVED : UNSOLVED;
+
+  if (use_real && record->real_limit && record->real_limit < record->limit)
+    limit = record->real_limit;
+  else
+    limit = record->limit;
+  if (min_limit < 0 || limit < min_limit)
+    min_limit = limit;
+  if (limit > max_limit)
+    max_limit = limit;
+}
+
+/*------------------------------------------------------------------------*/
+
+// Later occurrences (for instance of repeated runs) override earlier ones.
+
+static int parse_line(Record *record, const char *line) {
+  const char *value;
+  size_t len;
+
+  if (strncmp(line, "[runlim] ", 9))
+    return 0;
+  line += 9;
+  value = strchr(line, ':');
+  if (!value)
+    return 0;
+  len = value - line;
+  value++;
+  while (*value == ' ' || *value == '\t')
+    value++;
+
+  if (len == 6 && !strncmp(line, "status", len)) {
+    len = strcspn(value, "\n");
+    if (len >= sizeof record->status)
+      len = sizeof record->status - 1;
+    memcpy(record->status, value, len);
+    record->status[len] = 0;
+    return 1;
+  }
+  if (len == 6 && !strncmp(line, "result", len))
+    return sscanf(value, "%d", &record->result) == 1;
+  if (len == 4 && !strncmp(line, "time", len))
+    return sscanf(value, "%lf", &record->time) == 1;
+  if (len == 4 && !strncmp(line, "real", len))
+    return sscanf(value, "%lf", &record->real) == 1;
+  if (len == 5 && !strncmp(line, "space", len))
+    return sscanf(value, "%lf", &record->space) == 1;
+  if (len == 10 && !strncmp(line, "time limit", len))
+    return sscanf(value, "%lf", &record->limit) == 1;
+  if (len == 15 && !strncmp(line, "real time limit", len))
+    return sscanf(value, "%lf", &record->real_limit) == 1;
+
+  return 0;
+}
+
+static int read_log_file(const char *path, const struct stat *buf, int flag,
+			 struct FTW *ftw) {
+  char *line = 0, *name;
+  size_t size = 0, len;
+  Record record;
+  FILE *file;
+
+  (void)buf;
+  (void)ftw;
+
+  if (flag != FTW_F)
+    return 0;
+
+  file = fopen(path, "r");
+  if (!file) {
+    warning("can not read '%s'", path);
+    return 0;
+  }
+
+  memset(&record, 0, sizeof record);
+  while (getline(&line, &size, file) > 0)
+    (void)parse_line(&record, line);
+  free(line);
+  fclose(file);
+
+  if (!record.status[0])
+    return 0;
+
+  name = strdup(path + set_path_length);
+  if (!name)
+    error("out-of-memory reading '%s'", path);
+  len = strlen(name);
+  if (len > strlen(suffix) && !strcmp(name + len - strlen(suffix), suffix))
+    name[len - strlen(suffix)] = 0;
+  add_record(name, &record);
+  free(name);
+
+  return 0;
+}
+
+static void read_summary_file(const char *path) {
+  char *line = 0, *fields[8], *p;
+  size_t size = 0, i;
+  long lineno = 0;
+  Record record;
+  FILE *file;
+
+  file = fopen(path, "r");
+  if (!file)
+    error("can not read summary file '%s'", path);
+
+  while (getline(&line, &size, file) > 0) {
+    lineno++;
+    line[strcspn(line, "\n")] = 0;
+    if (!line[0] || line[0] == '#')
+      continue;
+    for (p = line, i = 0; i < 8; i++) {
+      fields[i] = p;
+      p = strchr(p, '\t');
+      if (!p)
+	break;
+      *p++ = 0;
+    }
+    if (i != 7)
+      error("invalid summary line %ld in '%s'", lineno, path);
+    memset(&record, 0, sizeof record);
+    strncpy(record.status, fields[1], sizeof record.status - 1);
+    if (sscanf(fields[2], "%d", &record.result) != 1 ||
+	sscanf(fields[3], "%lf", &record.time) != 1 ||
+	sscanf(fields[4], "%lf", &record.real) != 1 ||
+	sscanf(fields[5], "%lf", &record.space) != 1 ||
+	sscanf(fields[6], "%lf", &record.limit) != 1 ||
+	sscanf(fields[7], "%lf", &record.real_limit) != 1)
+      error("invalid number in summary line %ld in '%s'", lineno, path);
+    add_record(fields[0], &record);
+  }
+
+  free(line);
+  fclose(file);
+}
+
+static void read_set(size_t i) {
+  const char *path = sets[i].path;
+  struct stat buf;
+
+  current_set = i;
+
+  if (stat(path, &buf))
+    error("can not access '%s'", path);
+
+  if (S_ISDIR(buf.st_mode)) {
+    set_path_length = strlen(path);
+    while (set_path_length && path[set_path_length - 1] == '/')
+      set_path_length--;
+    set_path_length++;
+    if (nftw(path, read_log_file, 16, FTW_PHYS))
+      error("can not traverse directory '%s'", path);
+  } else
+    read_summary_file(path);
+}
+
+/*------------------------------------------------------------------------*/
+
+// Unsolved and missing entries are scored with the time limit common to
+// all runs of all sets.  Otherwise, and if the runs were not limited at
+// all, the penalty would depend on the set and has to be given.
+
+static double penalty(void) {
+  if (time_limit)
+    return par * time_limit;
+  if (min_limit != max_limit)
+    error("time limits differ between runs (%.0f to %.0f seconds, "
+	  "use '--time-limit')",
+	  min_limit, max_limit);
+  if (max_limit >= NO_LIMIT)
+    error("runs without time limit (use '--time-limit')");
+  return par * max_limit;
+}
+
+// Virtual best solver entry of an instance.
+
+static Entry best_entry(const Instance *instance) {
+  Entry res = {0, MISSING};
+  const Entry *entry;
+  size_t i;
+
+  for (i = 0; i < num_sets; i++) {
+    entry = instance->entries + i;
+    if (entry->state == SOLVED) {
+      if (res.state != SOLVED || entry->time < res.time)
+	res = *entry;
+    } else if (entry->state == UNSOLVED && res.state == MISSING)
+      res = *entry;
+  }
+
+  return res;
+}
+
+static void score(Set *set, const Entry *entry) {
+  if (entry->state == SOLVED) {
+    set->solved++;
+    set->time += entry->time;
+    set->par += entry->time;
+  } else {
+    if (entry->state == MISSING)
+      set->missing++;
+    else
+      set->unsolved++;
+    set->par += penalty();
+  }
+}
+
+// Speedup of the set over the first set, on instances both solved.
+
+static void compare(Set *set, const Entry *entry, const Entry *base) {
+  double a, b, ratio;
+
+  if (entry->state != SOLVED || base->state != SOLVED)
+    return;
+
+  a = base->time > 0.01 ? base->time : 0.01;
+  b = entry->time > 0.01 ? entry->time : 0.01;
+  ratio = a / b;
+
+  set->compared++;
+  if (ratio > 1)
+    set->faster++;
+  else if (ratio < 1)
+    set->slower++;
+  set->log_speedup += log(ratio);
+}
+
+static void print_entry(const Entry *entry) {
+  if (entry->state == SOLVED)
+    printf(" %10.2f", entry->time);
+  else if (entry->state == UNSOLVED)
+    printf(" %10s", "unsolved");
+  else
+    printf(" %10s", "missing");
+}
+
+static int cmp_names(const void *p, const void *q) {
+  const Instance *a = *(Instance *const *)p, *b = *(Instance *const *)q;
+  return strcmp(a->name, b->name);
+}
+
+static void print_instances(void) {
+  Instance **sorted;
+  Entry best;
+  size_t i, j, n = 0;
+
+  sorted = malloc(num_instances * sizeof *sorted);
+  if (!sorted)
+    error("out-of-memory sorting instances");
+  for (i = 0; i < size_instances; i++)
+    if (instances[i])
+      sorted[n++] = instances[i];
+  assert(n == num_instances);
+  qsort(sorted, n, sizeof *sorted, cmp_names);
+
+  for (i = 0; i < n; i++) {
+    printf("%-24s", sorted[i]->name);
+    for (j = 0; j < num_sets; j++)
+      print_entry(sorted[i]->entries + j);
+    best = best_entry(sorted[i]);
+    print_entry(&best);
+    for (j = 1; j < num_sets; j++)
+      if (sorted[i]->entries[0].state == SOLVED &&
+	  sorted[i]->entries[j].state == SOLVED &&
+	  sorted[i]->entries[j].time > 0)
+	printf(" %8.2fx",
+	       sorted[i]->entries[0].time / sorted[i]->entries[j].time);
+    fputc('\n', stdout);
+  }
+
+  free(sorted);
+}
+
+/*------------------------------------------------------------------------*/
+
+static int cmp_floats(const void *p, const void *q) {
+  float a = *(const float *)p, b = *(const float *)q;
+  return a < b ? -1 : a > b;
+}
+
+// Column 'k' lists the sorted solved times of set 'k' (the last column
+// those of the virtual best solver), thus row 'n' has the time needed to
+// solve 'n' instances.
+
+static void write_cactus(void) {
+  size_t i, j, k, columns = num_sets + 1, rows = 0;
+  size_t *counts;
+  float *times;
+  Entry best;
+  FILE *file;
+
+  times = malloc(columns * num_instances * sizeof *times);
+  counts = calloc(columns, sizeof *counts);
+  if (!times || !counts)
+    error("out-of-memory allocating cactus data");
+
+  for (i = 0; i < size_instances; i++) {
+    if (!instances[i])
+      continue;
+    for (j = 0; j < num_sets; j++)
+      if (instances[i]->entries[j].state == SOLVED)
+	times[j * num_instances + counts[j]++] = instances[i]->entries[j].time;
+    best = best_entry(instances[i]);
+    if (best.state == SOLVED)
+      times[num_sets * num_instances + counts[num_sets]++] = best.time;
+  }
+
+  for (j = 0; j < columns; j++) {
+    qsort(times + j * num_instances, counts[j], sizeof *times, cmp_floats);
+    if (counts[j] > rows)
+      rows = counts[j];
+  }
+
+  file = fopen(cactus_path, "w");
+  if (!file)
+    error("can not write cactus data to '%s'", cactus_path);
+
+  fprintf(file, "#solved");
+  for (j = 0; j < num_sets; j++)
+    fprintf(file, " %s", sets[j].path);
+  fprintf(file, " vbs\n");
+
+  for (k = 0; k < rows; k++) {
+    fprintf(file, "%zu", k + 1);
+    for (j = 0; j < columns; j++)
+      if (k < counts[j])
+	fprintf(file, " %.2f", times[j * num_instances + k]);
+      else
+	fprintf(file, " -");
+    fputc('\n', file);
+  }
+
+  if (fclose(file))
+    error("can not close cactus data file '%s'", cactus_path);
+
+  free(counts);
+  free(times);
+}
+
+/*------------------------------------------------------------------------*/
+
+static void print_set(const char *name, const Set *set) {
+  printf("%-24s %8ld %8ld %8ld %14.2f %14.2f\n", name, set->solved,
+	 set->unsolved, set->missing, set->par, set->time);
+}
+
+static void report(void) {
+  Set best;
+  Entry entry;
+  char header[32];
+  size_t i, j;
+
+  memset(&best, 0, sizeof best);
+
+  for (i = 0; i < size_instances; i++) {
+    if (!instances[i])
+      continue;
+    for (j = 0; j < num_sets; j++) {
+      score(sets + j, instances[i]->entries + j);
+      if (j)
+	compare(sets + j, instances[i]->entries + j, instances[i]->entries);
+    }
+    entry = best_entry(instances[i]);
+    score(&best, &entry);
+    compare(&best, &entry, instances[i]->entries);
+  }
+
+  sprintf(header, "par%g", par);
+  printf("%-24s %8s %8s %8s %14s %14s\n", "set", "solved", "unsolved",
+	 "missing", header, "time");
+  for (j = 0; j < num_sets; j++)
+    print_set(sets[j].path, sets + j);
+  print_set("vbs", &best);
+
+  for (j = 1; j <= num_sets; j++) {
+    const Set *set = j < num_sets ? sets + j : &best;
+    if (!set->compared)
+      continue;
+    printf("speedup %s over %s: %.2f geometric mean on %ld instances "
+	   "(%ld faster, %ld slower)\n",
+	   j < num_sets ? set->path : "vbs", sets[0].path,
+	   exp(set->log_speedup / set->compared), set->compared,
+	   set->faster, set->slower);
+  }
+
+  printf("records: %ld, instances: %zu\n", records, num_instances);
+}
+
+/*------------------------------------------------------------------------*/
+
+static void parse_results(const char *list) {
+  const char *p = list;
+  char *end;
+  long value;
+
+  while (*p) {
+    value = strtol(p, &end, 10);
+    if (end == p || (*end && *end != ','))
+      error("invalid result list '%s'", list);
+    results = realloc(results, (num_results + 1) * sizeof *results);
+    if (!results)
+      error("out-of-memory parsing result list");
+    results[num_results++] = value;
+    p = *end ? end + 1 : end;
+  }
+}
+
+static double parse_positive_rhs(const char *arg) {
+  const char *p = strchr(arg, '=') + 1;
+  char *end;
+  double res = strtod(p, &end);
+  if (end == p || *end || res <= 0)
+    error("invalid argument in '%s'", arg);
+  return res;
+}
+
+int main(int argc, char **argv) {
+  size_t i;
+  int k;
+
+  sets = calloc(argc, sizeof *sets);
+  if (!sets)
+    error("out-of-memory allocating sets");
+
+  for (k = 1; k < argc; k++) {
+    if (!strcmp(argv[k], "-h") || !strcmp(argv[k], "--help")) {
+      printf(USAGE, PAR, SUFFIX);
+      exit(0);
+    } else if (strstr(argv[k], "--par=") == argv[k])
+      par = parse_positive_rhs(argv[k]);
+    else if (strstr(argv[k], "--time-limit=") == argv[k])
+      time_limit = parse_positive_rhs(argv[k]);
+    else if (!strcmp(argv[k], "--real"))
+      use_real = 1;
+    else if (strstr(argv[k], "--results=") == argv[k])
+      parse_results(strchr(argv[k], '=') + 1);
+    else if (strstr(argv[k], "--suffix=") == argv[k])
+      suffix = strchr(argv[k], '=') + 1;
+    else if (!strcmp(argv[k], "--instances"))
+      list_instances = 1;
+    else if (strstr(argv[k], "--cactus=") == argv[k]) {
+      cactus_path = strchr(argv[k], '=') + 1;
+      if (!*cactus_path)
+	error("argument missing in '%s'", argv[k]);
+    } else if (!strcmp(argv[k], "--summary"))
+      summary = 1;
+    else if (argv[k][0] == '-')
+      error("invalid option '%s' (try '-h')", argv[k]);
+    else
+      sets[num_sets++].path = argv[k];
+  }
+
+  if (summary && num_sets != 1)
+    error("'--summary' requires exactly one set");
+  if (!summary && num_sets < 2)
+    error("at least two sets required (try '-h')");
+
+  for (i = 0; i < num_sets; i++)
+    read_set(i);
+
+  if (!summary) {
+    report();
+    if (list_instances)
+      print_instances();
+    if (cactus_path)
+      write_cactus();
+  }
+
+  for (i = 0; i < size_instances; i++)
+    if (instances[i]) {
+      free(instances[i]->name);
+      free(instances[i]);
+    }
+  free(instances);
+  free(results);
+  free(sets);
+
+  return 0;
+}
@@ -2,36 +2,100 @@
      See LICENSE for copyright and restrictions on using this software.
 \*------------------------------------------------------------------------*/
 
+#define _GNU_SOURCE /* for 'pipe2' and 'splice' */
+
 #include <asm/param.h>
 #include <assert.h>
 #include <ctype.h>
 #include <dirent.h>
+#include <elf.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <linux/perf_event.h>
+#include <linux/taskstats.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/personality.h>
+#include <sys/prctl.h>
 #include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "runlim.h"
+
 /*------------------------------------------------------------------------*/
 
 #define SAMPLE_RATE 100000l /* in microseconds */
 #define REPORT_RATE 100l    /* in terms of sampling */
 #define KILL_DELAY 512l	    /* in milliseconds */
 
+#define NOISY_THRESHOLD 5l /* in percent */
+
+#define CPU_PERIOD 100000l /* 'cpu.max' period in microseconds */
+
+#define ENERGY_BASELINE 500 /* in milliseconds */
+
+#define THREAD_BLOCKERS 5 /* reported blocking functions */
+
+#define PROFILE_FREQUENCY 499 /* samples per second */
+#define PROFILE_PAGES 64      /* ring buffer pages (power of two) */
+#define PROFILE_STACKS (1 << 14)
+#define PROFILE_DEPTH 127
+
+#define TASKSTATS_BUFFER (1 << 20) /* netlink receive buffer in bytes */
+
+#define BREAKDOWN 5l	    /* processes and executables listed */
+#define CMDLINE_SIZE 256 /* maximum bytes read from 'cmdline' */
+
+#define QUEUE_TIMEOUT 60l  /* in seconds */
+#define QUEUE_HEARTBEAT 10 /* in seconds */
+
+#define STREAM_CHUNK (1 << 16) /* bytes moved at once from output pipes */
+
+#define PRESSURE_RESOURCES 3 /* 'cpu', 'memory' and 'io' */
+#define THP_COUNTERS 5	     /* see 'thp_counter_names' */
+#define THREAD_STATES 5	     /* see 'thread_state_index' */
+
+#define STATUS_PAGE_DIR "/dev/shm"
+#define STATUS_PAGE_STALE 10 /* in seconds */
+
 /*------------------------------------------------------------------------*/
 
+typedef struct Blocker Blocker;
+typedef struct CachedFile CachedFile;
+typedef struct IO IO;
+typedef struct Names Names;
 typedef struct Process Process;
+typedef struct Profiled Profiled;
+typedef struct Stack Stack;
+typedef struct StatusPage StatusPage;
+typedef struct Stream Stream;
+typedef struct Symbols Symbols;
+typedef struct Zone Zone;
 typedef enum Status Status;
+typedef enum State State;
+
+typedef unsigned __int128 Hash;
 
 /*------------------------------------------------------------------------*/
 
@@ -41,6 +105,9 @@ enum Status {
   OUT_OF_MEMORY = 2,
   BUS_ERROR = 7,
   SEGMENTATION_FAULT = 11,
+  TERMINATED = 15,
+  OUT_OF_OUTPUT = 25,
+  OUT_OF_PROCESSES = 26,
   OTHER_SIGNAL = 100,
   INTERNAL_ERROR = 300,
   FORK_FAILED = 200,
@@ -49,18 +116,50 @@ enum Status {
 
 /*------------------------------------------------------------------------*/
 
+enum State { RUNNING = 0, KILLING = 1, FROZEN = 2 };
+
+/*------------------------------------------------------------------------*/
+
+struct IO {
+  long long rchar;
+  long long wchar;
+  long long syscr;
+  long long syscw;
+  long long read_bytes;
+  long long write_bytes;
+};
+
 struct Process {
   char new;
   char active;
   char cyclic_sampling;
   char cyclic_killing;
+  char counted;
+  char exited;
   int pid;
   int ppid;
   int pgrp;
   int psession;
+  unsigned long long start;
   long sampled;
   double time;
   double memory;
+  double wait;
+  long voluntary;
+  long involuntary;
+  long threads;
+  long minor_faults;
+  long major_faults;
+  double swap;
+  double huge;
+  double huge_memory; // memory when 'huge' was read
+  IO io;
+  int processor;
+  double peak_memory;
+  double exit_time;
+  double accounted;
+  char comm[16];
+  char *cmdline;
   Process *next_process;
   Process *first_child;
   Process *last_child;
@@ -70,6 +169,70 @@ struct Process {
 
 /*------------------------------------------------------------------------*/
 
+struct Names {
+  const char **start;
+  size_t count, size;
+};
+
+/*------------------------------------------------------------------------*/
+
+// Standard output and error of the program (see 'stream_thread_main').
+
+struct Stream {
+  runlim_ctx *ctx;
+  const char *name;
+  const char *path;
+  int fd;
+  int pipe[2];
+  int file;
+  int discard;
+  int copy;
+  pid_t compressor;
+  pthread_t thread;
+  int started;
+  long long bytes;
+  long long discarded;
+  double end;
+};
+
+#define NUM_STREAMS 2
+
+/*------------------------------------------------------------------------*/
+
+/* The status page is a memory mapped file shared with external monitors
+ * (for instance 'runlim --top').  Its layout is fixed and only consists of
+ * fixed width fields, since readers might be compiled separately.  Updates
+ * are protected by a sequence lock.  The writer increments 'sequence' to
+ * an odd value before and to an even value after updating the other fields.
+ * Readers retry as long as the sequence is odd or changed while copying.
+ */
+
+#define STATUS_PAGE_MAGIC 0x70616765756e726cull
+#define STATUS_PAGE_VERSION 1
+
+struct StatusPage {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t sequence;
+  int32_t pid;
+  int32_t child;
+  int32_t state;
+  int32_t processes;
+  int64_t samples;
+  double start;
+  double updated;
+  double time;
+  double real;
+  double memory;
+  double load;
+  double time_limit;
+  double real_time_limit;
+  double space_limit;
+  char program[64];
+};
+
+/*------------------------------------------------------------------------*/
+
 #define USAGE                                                                  \
   "usage: runlim [option ...] program [arg ...]\n"                             \
   "\n"                                                                         \
@@ -91,6 +254,15 @@ struct Process {
   "  --real-time-limit=<number> set real time limit to <number> seconds\n"     \
   "  -r <number>\n"                                                            \
   "\n"                                                                         \
+  "  --soft-time-limit=<number> notify at <number> seconds\n"                  \
+  "  --soft-space-limit=<number>\n"                                            \
+  "                             notify at <number> MB "                        \
+  "(and 'memory.high' in cgroup)\n"                                            \
+  "  --soft-signal=<number>     notification signal "                          \
+  "(default %d 'SIGUSR2', 0 none)\n"                                           \
+  "  --soft-fd=<number>         also write notifications to descriptor "       \
+  "<number>\n"                                                                 \
+  "\n"                                                                         \
   "  --sample-rate=<number>     sample rate in microseconds "                  \
   "(default %ld)\n"                                                            \
   "\n"                                                                         \
@@ -111,60 +283,441 @@ struct Process {
   "  --propagate                propagate exit code\n"                         \
   "  -p\n"                                                                     \
   "\n"                                                                         \
-  "The program is the name of an executable followed by its arguments.\n"
+  "  --repeat=<number>          run program <number> times\n"                  \
+  "  --warmup=<number>          additional unmeasured warmup runs\n"           \
+  "  --repeat-ci=<number>       stop at relative 95%% confidence "             \
+  "interval width\n"                                                           \
+  "                             below <number> percent\n"                      \
+  "\n"                                                                         \
+  "  --cache=<dir>              cache results in <dir>\n"                      \
+  "  --cache-env=<name>         include environment variable in cache key\n"   \
+  "  --cache-policy=<policy>    'exact', 'safe' (default) or 'timeouts'\n"     \
+  "\n"                                                                         \
+  "  --stdout=<file>            write standard output to <file>\n"             \
+  "  --stderr=<file>            write standard error output to <file>\n"       \
+  "  --output-limit=<number>    limit each to <number> MB\n"                   \
+  "  --stdin=<file>             read standard input from <file>\n"             \
+  "\n"                                                                         \
+  "  --queue=<dir>              run jobs from queue directory <dir>\n"         \
+  "  --queue-timeout=<number>   requeue jobs without heartbeat "               \
+  "(default %ld seconds)\n"                                                    \
+  "\n"                                                                         \
+  "  --status-page[=<dir>]      publish status page "                          \
+  "(default '" STATUS_PAGE_DIR "')\n"                                          \
+  "  --top[=<dir>]              show status pages of running jobs\n"           \
+  "\n"                                                                         \
+  "  --control=<socket>         accept commands on control socket\n"           \
+  "\n"                                                                         \
+  "  --cgroup=<dir>             run in new cgroup below <dir>\n"               \
+  "\n"                                                                         \
+  "  --frequency                sample CPU frequency and throttling\n"         \
+  "  --energy                   measure RAPL energy consumption\n"             \
+  "  --sysfs=<dir>              sysfs root directory (default '/sys')\n"       \
+  "\n"                                                                         \
+  "  --contention               measure and report contention\n"               \
+  "  --noisy-threshold=<number> noisy contention threshold "                   \
+  "(default %ld percent)\n"                                                    \
+  "\n"                                                                         \
+  "  --max-processes=<number>   limit number of processes\n"                   \
+  "  --max-threads=<number>     limit number of threads\n"                     \
+  "                             (checked while sampling, threads also "        \
+  "in kernel\n"                                                                \
+  "                             through 'pids.max' with '--cgroup')\n"         \
+  "\n"                                                                         \
+  "  --cold-cache=<files>       evict files from page cache\n"                 \
+  "  --warm-cache=<files>       read files, executable and libraries "         \
+  "into page cache\n"                                                          \
+  "\n"                                                                         \
+  "  --thp=<policy>             transparent huge pages 'always', "             \
+  "'never' or 'inherit'\n"                                                     \
+  "\n"                                                                         \
+  "  --no-aslr                  disable address space layout "                 \
+  "randomization\n"                                                            \
+  "  --clean-env                only pass PATH, HOME, USER, LANG, "            \
+  "LC_ALL and TZ\n"                                                            \
+  "  --keep-env=<name>          also pass variable <name>\n"                   \
+  "  --env-pad=<number>         pad environment to <number> bytes\n"           \
+  "\n"                                                                         \
+  "  --cores=<number>           limit CPU bandwidth to <number> cores "        \
+  "in cgroup\n"                                                                \
+  "  --cores-real-time          real time limit is time limit "                \
+  "divided by cores\n"                                                         \
+  "\n"                                                                         \
+  "  --io                       measure and report I/O\n"                      \
+  "  --io-max=<dev>:<rbps>:<wbps>\n"                                           \
+  "                             throttle device I/O in cgroup "                \
+  "(bytes per second)\n"                                                       \
+  "\n"                                                                         \
+  "  --swap                     measure and report swapped out memory\n"       \
+  "  --swap-in-space            count swapped out memory as space\n"           \
+  "\n"                                                                         \
+  "  --profile=<file>           write folded stacks of CPU profile "           \
+  "to <file>\n"                                                                \
+  "  --thread-states            report thread states and blocking "            \
+  "functions\n"                                                                \
+  "  --taskstats                exact exit times and delays from "             \
+  "taskstats\n"                                                                \
+  "\n"                                                                         \
+  "  --breakdown[=<number>]     list top processes and executables "           \
+  "(default %ld)\n"                                                            \
+  "  --cmdline                  show arguments in breakdown\n"                 \
+  "\n"                                                                         \
+  "The program is the name of an executable followed by its arguments.\n"      \
+  "In queue mode the program is read from the job files instead.\n"
 
 /*------------------------------------------------------------------------*/
 
-static FILE *log;
-static int close_log;
-static int debug_messages;
+/* All state of a job is kept in its context (see 'runlim.h'), such that
+ * contexts of the library can run jobs concurrently in different threads
+ * of the same process.  The command line tool runs one context.
+ *
+ * Errors do not exit the process but jump to the innermost recovery point
+ * of the raising thread.  This is either the one in 'runlim_run' or, for
+ * code running under the sampler mutex (sampling in the sampler thread and
+ * control commands), one in that code, which releases the mutex, abandons
+ * the job and returns normally.  The job then ends as terminated and
+ * 'runlim_run' reports the error.  The forked child always leaves with
+ * '_exit', which neither runs 'atexit' handlers nor flushes the 'stdio'
+ * buffers of the caller.
+ */
+
+struct runlim_ctx {
+
+  // Library interface and sample callback thread.
+
+  runlim_sample_callback callback;
+  void *data;
+  int command_line; // set by 'main' only
+  int informed;     // '-h', '-v' or '--top' given
+  int running;
+  int failed;
+  runlim_sample sample;
+  long posted;
+  sem_t samples;
+  pthread_t callback_thread;
+  volatile int stopping;
+
+  // Messages and process information.
+
+  FILE *log;
+  int close_log;
+  int debug_messages;
+
+  char *buffer;
+  size_t size_buffer;
+  size_t pos_buffer;
+
+  long page_size;
+  long clock_ticks;
+  double memory_per_page;
+  double physical_memory;
+
+  int forked_child;
+  long supervisor; // thread identifier of the supervising thread
+  int child_pid;
+  int child_reaped;
+  int parent_pid;
+  int group_pid;
+  int session_pid;
+
+  // Options and limits.
+
+  const char *cgroup_parent;
+  char *cgroup_path;
+  Names io_max_specs;
+
+  long process_limit;
+  long thread_limit;
+
+  double cores;
+  int cores_real_time;
+  long throttled_periods;
+  double throttled_time;
+
+  double soft_time_limit;
+  double soft_space_limit;
+  int soft_signal;
+  int soft_fd;
+  int soft_socket[2];
+  double soft_time_fired; // real time or negative if not fired
+  double soft_time_value;
+  double soft_space_fired;
+  double soft_space_value;
+  long memory_high_events;
+
+  int single;
+  int propagate_signals;
+  int propagate_exit_code;
+
+  double start_time;
+  double start_time_tai;
+  double time_limit;
+  double real_time_limit;
+  double space_limit;
+
+  // Statistics of the current run.
+
+  long num_samples;
+  long num_reports;
+  long num_samples_since_last_report;
+
+  double max_time;
+  double max_memory;
+  double max_wait;
+  long max_voluntary;
+  long max_involuntary;
+  long max_process_count;
+  long max_thread_count;
+  long max_minor_faults;
+  long max_major_faults;
+  double max_swap;
+  double max_huge;
+  double max_load;
+  int children;
+
+  double accumulated_time;
+  double accumulated_wait;
+  long accumulated_voluntary;
+  long accumulated_involuntary;
+
+  double sampled_time;
+  double sampled_memory;
+  double sampled_wait;
+  long sampled_voluntary;
+  long sampled_involuntary;
+  long sampled_processes;
+  long sampled_threads;
+  long sampled_minor_faults;
+  long sampled_major_faults;
+  double sampled_swap;
+  double sampled_huge;
+
+  // Process table.
+
+  Process **process_hash_table;
+  size_t size_of_process_hash_table;
+  size_t processes;
+  Process *active_processes;
+  Process *last_active_process;
+
+  // Optional measurements.
+
+  int contention;
+  long noisy_threshold;
+  double pressure_some[PRESSURE_RESOURCES];
+  double pressure_full[PRESSURE_RESOURCES];
+  int pressure_available;
+
+  int cpu_frequency;
+  const char *sysfs_root;
+  int num_cpus;
+  char *cpus_in_sample;
+  long *throttle_start;
+  double frequency_sum;
+  long frequency_samples;
+  double min_frequency;
+
+  int swap;
+  int swap_in_space;
+
+  int thp;
+  int huge_pages_due; // report due (see 'HUGE_PAGES_GROWTH')
+  long long thp_counters[THP_COUNTERS];
+
+  int io_accounting;
+  IO accumulated_io;
+  IO sampled_io;
+  IO max_io;
+  IO last_io;
+  double last_io_time;
+  double max_read_rate;
+  double max_write_rate;
+
+  long breakdown;
+  int show_cmdline;
+
+  int taskstats;
+  int taskstats_socket;
+  int taskstats_family;
+  long taskstats_exits;
+  long taskstats_lost;
+  double taskstats_user;
+  double taskstats_system;
+  double max_hiwater;
+  double cpu_delay;
+  double blkio_delay;
+  double swapin_delay;
+
+  int thread_states;
+  double thread_state_seconds[THREAD_STATES];
+  double thread_state_period;
+  double last_thread_state_sample;
+  Blocker *blockers;
+  size_t num_blockers;
+  size_t size_blockers;
+
+  const char *profile_path;
+  int *profile_fds;
+  void **profile_buffers;
+  int num_profile_events;
+  Profiled *profiled;
+  size_t num_profiled, size_profiled;
+  Stack **stacks;
+  long profile_samples, profile_lost;
+  Symbols *symbols;
+
+  int energy;
+  Zone *zones;
+  int num_zones;
+  int zones_searched;
+  double energy_baseline; // in watts
+  double busy_time_start; // in seconds
+  double energy_start;    // wall clock time
+
+  // Killing and freezing.
+
+  pthread_mutex_t killing_mutex;
+  volatile int killing;
+  long kill_delay;
+
+  volatile int caught_out_of_memory;
+  volatile int caught_out_of_time;
+  volatile int caught_terminate;
+  volatile int caught_out_of_output;
+  volatile int caught_out_of_processes;
+  volatile int output_limit_exceeded;
+  volatile int terminate_requested;
+  volatile int caught_other_signal;
+  int exec_failed;
+
+  volatile int frozen;
+  double frozen_since;
+  double frozen_time;
+  long freezes;
+
+  // Sampler thread (see 'sampler_thread_main').
+
+  long sample_rate;
+  long report_rate;
+  double last_load;
+
+  // The sampler mutex protects sampling against concurrent commands from
+  // the control thread (see 'run_under_sampler_mutex').
+
+  pthread_mutex_t sampler_mutex;
+  pthread_cond_t sampler_wakeup;
+  pthread_t sampler_thread;
+  int sampler_started;
+  int sampling;
+  int rearm_sampler;
+
+  // Status page, control socket and queue.
+
+  const char *status_page_dir;
+  char *status_page_path;
+  StatusPage *status_page;
+
+  const char *control_path;
+  int control_socket;
+  pthread_t control_thread;
+  int control_thread_started;
+
+  const char *queue_dir;
+  long queue_timeout;
+  char *queue_clock_path;
+  const char *queue_heartbeat_path;
+  double last_queue_heartbeat;
+
+  // Environment and streams of the program.
+
+  int no_aslr;
+  int clean_env;
+  Names keep_env;
+  long env_pad;
+  char **environment;
+  size_t environment_variables;
+  size_t environment_bytes;
+
+  Stream streams[NUM_STREAMS];
+  const char *stdin_path;
+  int stdin_file;
+  double output_limit; // in MB, zero means unlimited
+
+  // Repeated runs and caching.
+
+  long repeat;
+  long warmup;
+  long repeat_ci;
+  double *real_times;
+  double *process_times;
+  double *spaces;
+  long measured_runs;
+  long *outcome_counts;
+
+  CachedFile *cached_files;
+  size_t num_cached_files;
+
+  const char *cache_dir;
+  int cache_policy;
+  Names cache_env;
+  Hash cache_key;
+  char cache_name[33];
+};
+
+static __thread sigjmp_buf *recovery;
 
 /*------------------------------------------------------------------------*/
 
-static void usage(void) {
-  fprintf(log, USAGE, SAMPLE_RATE, REPORT_RATE, KILL_DELAY);
-  fflush(log);
+static void usage(runlim_ctx *ctx) {
+  fprintf(ctx->log, USAGE, SIGUSR2, SAMPLE_RATE, REPORT_RATE, KILL_DELAY,
+	  QUEUE_TIMEOUT, NOISY_THRESHOLD, BREAKDOWN);
+  fflush(ctx->log);
 }
 
 /*------------------------------------------------------------------------*/
 
-static void error(const char *fmt, ...) {
+static void error(runlim_ctx *ctx, const char *fmt, ...) {
   va_list ap;
-  assert(log);
-  fputs("runlim error: ", log);
+  assert(ctx->log);
+  fputs("runlim error: ", ctx->log);
   va_start(ap, fmt);
-  vfprintf(log, fmt, ap);
-  fputc('\n', log);
+  vfprintf(ctx->log, fmt, ap);
+  fputc('\n', ctx->log);
   va_end(ap);
-  fflush(log);
-  exit(1);
+  fflush(ctx->log);
+  if (ctx->forked_child)
+    _exit(1);
+  ctx->failed = 1;
+  if (recovery)
+    siglongjmp(*recovery, 1);
+  abort();
 }
 
-static void warning(const char *fmt, ...) {
+static void warning(runlim_ctx *ctx, const char *fmt, ...) {
   va_list ap;
-  assert(log);
-  fputs("runlim warning: ", log);
+  assert(ctx->log);
+  fputs("runlim warning: ", ctx->log);
   va_start(ap, fmt);
-  vfprintf(log, fmt, ap);
-  fputc('\n', log);
+  vfprintf(ctx->log, fmt, ap);
+  fputc('\n', ctx->log);
   va_end(ap);
-  fflush(log);
+  fflush(ctx->log);
 }
 
-/* Messages are also generated while sampling, i.e., asynchronously
- * triggered by the timer in signal handlers, we have to be careful not to
- * garble sample messages with other messages.  The current solution is
- * better than the previous one using similar approaches as 'warning' and
- * 'error' but still not robust, which would need to use separate logging
- * threads.
+/* Messages are also generated while sampling, i.e., concurrently in the
+ * sampler thread, and by the threads of other contexts sharing the log.
+ * Each message is formatted into a local buffer first and then written
+ * with a single 'fputs', which locks the stream, such that lines are not
+ * garbled.
  */
 
-static void message(const char *type, const char *fmt, ...) {
+static void message(runlim_ctx *ctx, const char *type, const char *fmt,
+		    ...) {
   char buffer[1024];
   const size_t size_buffer = sizeof buffer - 1;
   size_t len;
   va_list ap;
-  assert(log);
+  assert(ctx->log);
   buffer[0] = 0;
   strncat(buffer, "[runlim] ", size_buffer);
   strncat(buffer, type, size_buffer);
@@ -178,15 +731,15 @@ static void message(const char *type, const char *fmt, ...) {
   vsnprintf(buffer + len, size_buffer - len, fmt, ap);
   va_end(ap);
   strncat(buffer, "\n", size_buffer);
-  fputs(buffer, log);
-  fflush(log);
+  fputs(buffer, ctx->log);
+  fflush(ctx->log);
 }
 
-#define debug(TYPE, FMT, ARGS...)                                              \
+#define debug(CTX, TYPE, FMT, ARGS...)                                         \
   do {                                                                         \
-    if (debug_messages <= 0)                                                   \
+    if ((CTX)->debug_messages <= 0)                                            \
       break;                                                                   \
-    message(TYPE, FMT, ##ARGS);                                                \
+    message(CTX, TYPE, FMT, ##ARGS);                                           \
   } while (0)
 
 /*------------------------------------------------------------------------*/
@@ -201,6 +754,9 @@ static int is_positive_long(const char *str, long *res_ptr) {
 
   res = 0;
   for (p = str; (ch = *p); p++) {
+    if (!isdigit(ch))
+      return 0;
+
     if (LLONG_MAX / 10 < res)
       return 0;
 
@@ -220,24 +776,25 @@ static int is_positive_long(const char *str, long *res_ptr) {
 
 /*------------------------------------------------------------------------*/
 
-static long parse_number_argument(int *i, int argc, char **argv) {
+static long parse_number_argument(runlim_ctx *ctx, int *i, int argc,
+				  char **argv) {
   char ch = argv[*i][1];
   long res;
 
   if (argv[*i][2]) {
     if (!is_positive_long(argv[*i] + 2, &res))
-      error("invalid argument in '%s'", argv[*i]);
+      error(ctx, "invalid argument in '%s'", argv[*i]);
   } else if (*i + 1 < argc && is_positive_long(argv[*i + 1], &res)) {
     *i += 1;
   } else
-    error("argument missing for '-%c'", ch);
+    error(ctx, "argument missing for '-%c'", ch);
 
   return res;
 }
 
 /*------------------------------------------------------------------------*/
 
-static long parse_number_rhs(char *str) {
+static long parse_number_rhs(runlim_ctx *ctx, char *str) {
   long res;
   char *p;
 
@@ -245,41 +802,53 @@ static long parse_number_rhs(char *str) {
   assert(p);
 
   if (!p[1])
-    error("argument missing in '%s'", str);
+    error(ctx, "argument missing in '%s'", str);
 
   if (!is_positive_long(p + 1, &res))
-    error("invalid argument in '%s'", str);
+    error(ctx, "invalid argument in '%s'", str);
 
   return res;
 }
 
-/*------------------------------------------------------------------------*/
+static double parse_positive_double_rhs(runlim_ctx *ctx, char *str) {
+  char *p, *end;
+  double res;
+
+  p = strchr(str, '=');
+  assert(p);
+
+  if (!p[1])
+    error(ctx, "argument missing in '%s'", str);
+
+  errno = 0;
+  res = strtod(p + 1, &end);
+  if (errno || *end || !(res > 0))
+    error(ctx, "invalid argument in '%s'", str);
 
-static char *buffer;
-static size_t size_buffer;
-static size_t pos_buffer;
+  return res;
+}
 
 /*------------------------------------------------------------------------*/
 
-static void push_buffer(int ch) {
-  if (size_buffer == pos_buffer) {
-    size_buffer = size_buffer ? 2 * size_buffer : 128;
-    buffer = realloc(buffer, size_buffer);
-    if (!buffer)
-      error("out-of-memory reallocating buffer");
+static void push_buffer(runlim_ctx *ctx, int ch) {
+  if (ctx->size_buffer == ctx->pos_buffer) {
+    ctx->size_buffer = ctx->size_buffer ? 2 * ctx->size_buffer : 128;
+    ctx->buffer = realloc(ctx->buffer, ctx->size_buffer);
+    if (!ctx->buffer)
+      error(ctx, "out-of-memory reallocating buffer");
   }
 
-  buffer[pos_buffer++] = ch;
+  ctx->buffer[ctx->pos_buffer++] = ch;
 }
 
 /*------------------------------------------------------------------------*/
 
-static int try_to_remount_proc_file_system(void) {
+static int try_to_remount_proc_file_system(runlim_ctx *ctx) {
   const char *remount_path = "runlim-remount-proc";
   const char *type = "remount '/proc'";
   int pid, res, status;
 
-  debug(type, "trying to remount '/proc' file system");
+  debug(ctx, type, "trying to remount '/proc' file system");
 
   pid = fork();
   if (pid < 0)
@@ -287,130 +856,456 @@ static int try_to_remount_proc_file_system(void) {
 
   if (!pid) {
     execlp(remount_path, remount_path, (char *)0);
-    exit(2);
+    _exit(2);
   }
 
   res = waitpid(pid, &status, 0);
   if (res < 0) {
-    debug(type, "failed to wait for '%s' process child", remount_path);
+    debug(ctx, type, "failed to wait for '%s' process child", remount_path);
     return 0;
   }
 
   assert(res == pid);
 
   if (!WIFEXITED(status)) {
-    debug(type, "'%s' process did not exit properly", remount_path);
+    debug(ctx, type, "'%s' process did not exit properly", remount_path);
     return 0;
   }
 
   res = WEXITSTATUS(status);
   if (res == 2) {
-    debug(type, "execution of '%s' process failed", remount_path);
+    debug(ctx, type, "execution of '%s' process failed", remount_path);
     return 0;
   }
 
   if (res) {
-    debug(type, "mounting '/proc' through '%s' failed", remount_path);
+    debug(ctx, type, "mounting '/proc' through '%s' failed", remount_path);
     return 0;
   }
 
-  warning("remounted '/proc' file system");
+  warning(ctx, "remounted '/proc' file system");
 
   return 1;
 }
 
-static FILE *open_proc_file_path_for_reading(const char *path) {
+static FILE *open_proc_file_path_for_reading(runlim_ctx *ctx,
+					     const char *path) {
   FILE *file = fopen(path, "r");
   if (!file) {
-    if (try_to_remount_proc_file_system())
+    if (try_to_remount_proc_file_system(ctx))
       file = fopen(path, "r");
     if (!file)
-      error("can not open '%s' for reading", path);
+      error(ctx, "can not open '%s' for reading", path);
   }
   return file;
 }
 
 /*------------------------------------------------------------------------*/
 
-static const char *read_host_name() {
+static const char *read_host_name(runlim_ctx *ctx) {
   const char *host_name_path = "/proc/sys/kernel/hostname";
   FILE *file;
   int ch;
 
-  file = open_proc_file_path_for_reading(host_name_path);
+  file = open_proc_file_path_for_reading(ctx, host_name_path);
 
-  pos_buffer = 0;
+  ctx->pos_buffer = 0;
   while ((ch = getc_unlocked(file)) != EOF && ch != '\n')
-    push_buffer(ch);
+    push_buffer(ctx, ch);
 
-  push_buffer(0);
+  push_buffer(ctx, 0);
 
   (void)fclose(file);
 
-  return buffer;
+  return ctx->buffer;
 }
 
 /*------------------------------------------------------------------------*/
 
-static long page_size;
-static long clock_ticks;
-
-static double memory_per_page;
-static double physical_memory;
-
-static void get_page_size() {
-  page_size = (long)sysconf(_SC_PAGE_SIZE);
-  if (page_size <= 0)
-    page_size = 4096;
-  memory_per_page = page_size / (double)(1 << 20);
-  debug("page size", "%ld bytes", page_size);
-  debug("memory per page", "%g MB", memory_per_page);
+static void get_page_size(runlim_ctx *ctx) {
+  ctx->page_size = (long)sysconf(_SC_PAGE_SIZE);
+  if (ctx->page_size <= 0)
+    ctx->page_size = 4096;
+  ctx->memory_per_page = ctx->page_size / (double)(1 << 20);
+  debug(ctx, "page size", "%ld bytes", ctx->page_size);
+  debug(ctx, "memory per page", "%g MB", ctx->memory_per_page);
 }
 
-static void get_physical_memory() {
+static void get_physical_memory(runlim_ctx *ctx) {
   long tmp;
-  assert(page_size > 0);
-  tmp = page_size * sysconf(_SC_PHYS_PAGES);
-  physical_memory = tmp / (double)(1 << 20);
-  debug("physical memory", "%.0f MB", physical_memory);
+  assert(ctx->page_size > 0);
+  tmp = ctx->page_size * sysconf(_SC_PHYS_PAGES);
+  ctx->physical_memory = tmp / (double)(1 << 20);
+  debug(ctx, "physical memory", "%.0f MB", ctx->physical_memory);
 }
 
 #ifndef HZ
 #define HZ 100
 #endif
 
-static void get_clock_ticks() {
-  clock_ticks = sysconf(_SC_CLK_TCK);
-  if (clock_ticks <= 0)
-    clock_ticks = HZ;
-  debug("clock ticks", "%ld", clock_ticks);
+static void get_clock_ticks(runlim_ctx *ctx) {
+  ctx->clock_ticks = sysconf(_SC_CLK_TCK);
+  if (ctx->clock_ticks <= 0)
+    ctx->clock_ticks = HZ;
+  debug(ctx, "clock ticks", "%ld", ctx->clock_ticks);
+}
+
+/*------------------------------------------------------------------------*/
+
+static void push_name(runlim_ctx *ctx, Names *names, const char *name) {
+  if (names->count == names->size) {
+    names->size = names->size ? 2 * names->size : 4;
+    names->start =
+	realloc(names->start, names->size * sizeof *names->start);
+    if (!names->start)
+      error(ctx, "out-of-memory reallocating names");
+  }
+  names->start[names->count++] = name;
+}
+
+static void release_names(Names *names) {
+  free(names->start);
+  memset(names, 0, sizeof *names);
+}
+
+/*------------------------------------------------------------------------*/
+
+/* In cgroup mode the child process is moved into a fresh cgroup (version
+ * 2) below the directory given with '--cgroup', which thus has to be
+ * writable and delegated to the user running 'runlim'.
+ */
+
+static int write_cgroup_file(runlim_ctx *ctx, const char *name, const char *fmt,
+			     ...) {
+  char path[PATH_MAX];
+  va_list ap;
+  FILE *file;
+  int res;
+
+  assert(ctx->cgroup_path);
+
+  snprintf(path, sizeof path, "%s/%s", ctx->cgroup_path, name);
+  file = fopen(path, "w");
+  if (!file)
+    return 0;
+
+  va_start(ap, fmt);
+  res = vfprintf(file, fmt, ap) >= 0;
+  va_end(ap);
+
+  if (fclose(file))
+    res = 0;
+
+  debug(ctx, "cgroup", "%s %s", res ? "wrote" : "failed to write", path);
+
+  return res;
+}
+
+static void create_cgroup(runlim_ctx *ctx) {
+  char path[PATH_MAX];
+  struct stat buf;
+  size_t len;
+
+  assert(ctx->cgroup_parent);
+  assert(!ctx->cgroup_path);
+
+  snprintf(path, sizeof path, "%s/cgroup.controllers", ctx->cgroup_parent);
+  if (stat(path, &buf))
+    error(ctx, "'%s' is not a cgroup (version 2) directory",
+	  ctx->cgroup_parent);
+
+  len = strlen(ctx->cgroup_parent) + 32;
+  ctx->cgroup_path = malloc(len);
+  if (!ctx->cgroup_path)
+    error(ctx, "out-of-memory allocating cgroup path");
+  snprintf(ctx->cgroup_path, len, "%s/runlim.%ld", ctx->cgroup_parent,
+	   ctx->supervisor);
+
+  if (mkdir(ctx->cgroup_path, 0755))
+    error(ctx, "can not create cgroup '%s'", ctx->cgroup_path);
+}
+
+static int join_cgroup(runlim_ctx *ctx, int pid) {
+  assert(ctx->cgroup_path);
+  return write_cgroup_file(ctx, "cgroup.procs", "%d\n", pid);
+}
+
+static void remove_cgroup(runlim_ctx *ctx) {
+  int attempts;
+
+  if (!ctx->cgroup_path)
+    return;
+
+  (void)write_cgroup_file(ctx, "cgroup.kill", "1\n");
+
+  for (attempts = 0; attempts < 100; attempts++) {
+    if (!rmdir(ctx->cgroup_path) || errno != EBUSY)
+      break;
+    usleep(10000);
+  }
+
+  if (attempts == 100)
+    warning(ctx, "could not remove cgroup '%s'", ctx->cgroup_path);
+
+  free(ctx->cgroup_path);
+  ctx->cgroup_path = 0;
+}
+
+/* Each '--io-max=<device>:<rbps>:<wbps>' installs a throttle in 'io.max'
+ * of the cgroup.  The device is either given as '<major>:<minor>' or as
+ * path of a block device, and the limits in bytes per second or 'max'.
+ */
+
+static int parse_io_limit(const char *str, size_t len) {
+  if (len == 3 && !strncmp(str, "max", 3))
+    return 1;
+  if (!len)
+    return 0;
+  while (len--)
+    if (!isdigit((unsigned char)*str++))
+      return 0;
+  return 1;
+}
+
+static int parse_io_max(const char *spec, char *line, size_t size) {
+  const char *wbps, *rbps;
+  unsigned major_number, minor_number;
+  char device[PATH_MAX];
+  struct stat buf;
+  char end;
+
+  wbps = strrchr(spec, ':');
+  if (!wbps || wbps == spec)
+    return 0;
+  rbps = wbps - 1;
+  while (rbps > spec && *rbps != ':')
+    rbps--;
+  if (rbps == spec || (size_t)(rbps - spec) >= sizeof device)
+    return 0;
+  if (!parse_io_limit(rbps + 1, wbps - rbps - 1) ||
+      !parse_io_limit(wbps + 1, strlen(wbps + 1)))
+    return 0;
+
+  memcpy(device, spec, rbps - spec);
+  device[rbps - spec] = 0;
+
+  if (sscanf(device, "%u:%u%c", &major_number, &minor_number, &end) != 2) {
+    if (stat(device, &buf) || !S_ISBLK(buf.st_mode))
+      return 0;
+    major_number = major(buf.st_rdev);
+    minor_number = minor(buf.st_rdev);
+  }
+
+  snprintf(line, size, "%u:%u rbps=%.*s wbps=%s", major_number, minor_number,
+	   (int)(wbps - rbps - 1), rbps + 1, wbps + 1);
+
+  return 1;
+}
+
+// Try to enable a controller for the new cgroup if the given controller
+// file is missing.
+
+static void enable_cgroup_controller(runlim_ctx *ctx, const char *controller,
+				     const char *name) {
+  char path[PATH_MAX];
+  struct stat buf;
+  FILE *file;
+
+  snprintf(path, sizeof path, "%s/%s", ctx->cgroup_path, name);
+  if (!stat(path, &buf))
+    return;
+
+  snprintf(path, sizeof path, "%s/cgroup.subtree_control", ctx->cgroup_parent);
+  file = fopen(path, "w");
+  if (!file)
+    return;
+  fprintf(file, "+%s\n", controller);
+  (void)fclose(file);
+}
+
+static void install_io_max(runlim_ctx *ctx) {
+  char line[128];
+  size_t i;
+
+  if (!ctx->io_max_specs.count)
+    return;
+
+  enable_cgroup_controller(ctx, "io", "io.max");
+
+  for (i = 0; i < ctx->io_max_specs.count; i++) {
+    if (!parse_io_max(ctx->io_max_specs.start[i], line, sizeof line)) {
+      remove_cgroup(ctx);
+      error(ctx, "invalid '--io-max=%s'", ctx->io_max_specs.start[i]);
+    }
+    if (!write_cgroup_file(ctx, "io.max", "%s\n", line)) {
+      remove_cgroup(ctx);
+      error(ctx, "can not write '%s' to 'io.max' in cgroup below '%s' "
+	    "('io' controller not enabled?)",
+	    line, ctx->cgroup_parent);
+    }
+    message(ctx, "io max", "%s", line);
+  }
 }
 
 /*------------------------------------------------------------------------*/
 
-static int child_pid = -1;
-static int parent_pid = -1;
-static int group_pid = -1;
-static int session_pid = -1;
+/* The number of processes and threads of the program can be limited with
+ * '--max-processes' and '--max-threads', which are checked while sampling.
+ * The kernel only limits the number of tasks, i.e., threads.  Thus only
+ * the thread limit is also enforced by the kernel, through 'pids.max' in
+ * cgroup mode.  Without a cgroup there is no per-job kernel limit, since
+ * 'RLIMIT_NPROC' counts all tasks of the user including those of other
+ * jobs, and the limits are only checked while sampling.
+ */
+
+static void install_task_limits(runlim_ctx *ctx) {
+  if (!ctx->thread_limit || !ctx->cgroup_path)
+    return;
+
+  enable_cgroup_controller(ctx, "pids", "pids.max");
+  if (write_cgroup_file(ctx, "pids.max", "%ld\n", ctx->thread_limit))
+    message(ctx, "pids max", "%ld", ctx->thread_limit);
+  else
+    warning(ctx, "can not write 'pids.max' of cgroup '%s' "
+	    "(thread limit only checked while sampling)",
+	    ctx->cgroup_path);
+}
+
+// Determines whether the kernel rejected a fork due to 'pids.max'.
+
+static int reached_pids_max(runlim_ctx *ctx) {
+  char path[PATH_MAX], line[128];
+  FILE *file;
+  long events = 0;
+
+  if (!ctx->cgroup_path || !ctx->thread_limit)
+    return 0;
+
+  snprintf(path, sizeof path, "%s/pids.events", ctx->cgroup_path);
+  file = fopen(path, "r");
+  if (!file)
+    return 0;
+  while (fgets(line, sizeof line, file))
+    if (sscanf(line, "max %ld", &events) == 1)
+      break;
+  fclose(file);
+
+  return events > 0;
+}
 
 /*------------------------------------------------------------------------*/
 
-static long num_samples;
-static long num_reports;
+/* With '--cores=<number>' the CPU bandwidth of the cgroup is limited in
+ * 'cpu.max' to the given (fractional) number of cores.  The time the
+ * program was throttled is read from 'cpu.stat' at the end.  With
+ * '--cores-real-time' the real time limit is derived from the time limit
+ * divided by the number of cores.
+ */
+
+static void install_cpu_max(runlim_ctx *ctx) {
+  long quota;
+
+  if (!ctx->cores)
+    return;
+
+  quota = ctx->cores * CPU_PERIOD;
+  if (quota < 1000)
+    quota = 1000; // minimum supported by the kernel
+
+  enable_cgroup_controller(ctx, "cpu", "cpu.max");
+  if (!write_cgroup_file(ctx, "cpu.max", "%ld %ld\n", quota, CPU_PERIOD)) {
+    remove_cgroup(ctx);
+    error(ctx, "can not write 'cpu.max' in cgroup below '%s' "
+	  "('cpu' controller not enabled?)",
+	  ctx->cgroup_parent);
+  }
+  message(ctx, "cpu max", "%ld %ld", quota, CPU_PERIOD);
+}
+
+// Needs to be called before the cgroup is removed.
+
+static void read_cpu_stat(runlim_ctx *ctx) {
+  char path[PATH_MAX], line[128];
+  long long usec;
+  FILE *file;
+  long count;
 
-static long num_samples_since_last_report;
+  ctx->throttled_periods = 0;
+  ctx->throttled_time = 0;
 
-static double max_time;
-static double max_memory;
+  if (!ctx->cgroup_path || !ctx->cores)
+    return;
 
-static double max_load;
+  snprintf(path, sizeof path, "%s/cpu.stat", ctx->cgroup_path);
+  file = fopen(path, "r");
+  if (!file)
+    return;
+  while (fgets(line, sizeof line, file)) {
+    if (sscanf(line, "nr_throttled %ld", &count) == 1)
+      ctx->throttled_periods = count;
+    else if (sscanf(line, "throttled_usec %lld", &usec) == 1)
+      ctx->throttled_time = 1e-6 * usec;
+  }
+  fclose(file);
+}
 
 /*------------------------------------------------------------------------*/
 
-static int single;
-static int propagate_signals;
-static int propagate_exit_code;
-static int children;
+/* Soft limits notify the program once before the hard limits are reached,
+ * by sending 'soft_signal' to all its processes and, if '--soft-fd' is
+ * given, by writing a line to a socket passed to the program as that file
+ * descriptor (see 'fire_soft_limit').  In cgroup mode the soft space limit
+ * is also installed as 'memory.high', above which the kernel throttles
+ * and reclaims memory of the job.  How often this happened is reported.
+ */
+
+static void install_memory_high(runlim_ctx *ctx) {
+  if (!ctx->soft_space_limit)
+    return;
+  enable_cgroup_controller(ctx, "memory", "memory.high");
+  if (write_cgroup_file(ctx, "memory.high", "%lld\n",
+			(long long)(ctx->soft_space_limit * (1 << 20))))
+    message(ctx, "memory high", "%.0f MB", ctx->soft_space_limit);
+  else
+    warning(ctx, "can not write 'memory.high' of cgroup '%s'",
+	    ctx->cgroup_path);
+}
+
+// Needs to be called before the cgroup is removed.
+
+static void read_memory_events(runlim_ctx *ctx) {
+  char path[PATH_MAX], line[128];
+  FILE *file;
+  long count;
+
+  ctx->memory_high_events = -1;
+
+  if (!ctx->cgroup_path || !ctx->soft_space_limit)
+    return;
+
+  snprintf(path, sizeof path, "%s/memory.events", ctx->cgroup_path);
+  file = fopen(path, "r");
+  if (!file)
+    return;
+  while (fgets(line, sizeof line, file))
+    if (sscanf(line, "high %ld", &count) == 1)
+      ctx->memory_high_events = count;
+  fclose(file);
+}
+
+// Called in the child before executing the program.
+
+static void pass_soft_socket(runlim_ctx *ctx) {
+  int flags;
+  if (ctx->soft_socket[1] < 0)
+    return;
+  if (ctx->soft_socket[1] == ctx->soft_fd) {
+    flags = fcntl(ctx->soft_fd, F_GETFD);
+    if (flags < 0 || fcntl(ctx->soft_fd, F_SETFD, flags & ~FD_CLOEXEC) < 0)
+      _exit(1);
+  } else if (dup2(ctx->soft_socket[1], ctx->soft_fd) < 0)
+    _exit(1);
+}
 
 /*------------------------------------------------------------------------*/
 
@@ -425,21 +1320,10 @@ static int children;
 #define STIME_POS 15
 #define RSS_POS 24
 #define MAX_POS 24
+#define PROCESSOR_POS 39
 
 /*------------------------------------------------------------------------*/
 
-static double start_time;
-static double start_time_tai;
-static double time_limit;
-static double real_time_limit;
-static double space_limit;
-
-/*------------------------------------------------------------------------*/
-
-static Process **process_hash_table;
-static size_t size_of_process_hash_table;
-static size_t processes;
-
 #define PRIME1 10007
 #define PRIME2 27
 
@@ -451,67 +1335,69 @@ static int is_power_of_two(size_t n) { return n && !(n & (n - 1)); }
 
 #endif
 
-static size_t mod_size_of_process_hash_table(size_t n) {
-  assert(is_power_of_two(size_of_process_hash_table));
-  return n & (size_of_process_hash_table - 1);
+static size_t mod_size_of_process_hash_table(runlim_ctx *ctx, size_t n) {
+  assert(is_power_of_two(ctx->size_of_process_hash_table));
+  return n & (ctx->size_of_process_hash_table - 1);
 }
 
-static Process **look_up_process_in_process_hash_table(int pid) {
+static Process **look_up_process_in_process_hash_table(runlim_ctx *ctx,
+						       int pid) {
   size_t hash, pos;
   Process **res, *process;
 
-  assert(size_of_process_hash_table > processes);
+  assert(ctx->size_of_process_hash_table > ctx->processes);
 
   hash = hash_process_id(pid);
-  pos = mod_size_of_process_hash_table(hash);
+  pos = mod_size_of_process_hash_table(ctx, hash);
 
   for (;;) {
-    res = process_hash_table + pos;
+    res = ctx->process_hash_table + pos;
     process = *res;
     if (!process)
       return res;
     if (process->pid == pid)
       return res;
-    pos = mod_size_of_process_hash_table(pos + PRIME2);
+    pos = mod_size_of_process_hash_table(ctx, pos + PRIME2);
   }
 }
 
-static void resize_process_hash_table(void) {
+static void resize_process_hash_table(runlim_ctx *ctx) {
   Process **old_process_hash_table, *process, **p;
   size_t old_size_of_process_hash_table, pos;
   int pid;
 
-  old_size_of_process_hash_table = size_of_process_hash_table;
-  old_process_hash_table = process_hash_table;
+  old_size_of_process_hash_table = ctx->size_of_process_hash_table;
+  old_process_hash_table = ctx->process_hash_table;
 
-  size_of_process_hash_table = 2 * old_size_of_process_hash_table;
-  if (!size_of_process_hash_table)
-    size_of_process_hash_table = 2;
+  ctx->size_of_process_hash_table = 2 * old_size_of_process_hash_table;
+  if (!ctx->size_of_process_hash_table)
+    ctx->size_of_process_hash_table = 2;
 
-  debug("resize", "%zu", size_of_process_hash_table);
+  debug(ctx, "resize", "%zu", ctx->size_of_process_hash_table);
 
-  process_hash_table = calloc(size_of_process_hash_table, sizeof(Process));
-  if (!process_hash_table)
-    error("could not resize process hash table");
+  ctx->process_hash_table = calloc(ctx->size_of_process_hash_table,
+				   sizeof(Process));
+  if (!ctx->process_hash_table)
+    error(ctx, "could not resize process hash table");
 
   for (pos = 0; pos < old_size_of_process_hash_table; pos++) {
     process = old_process_hash_table[pos];
     if (!process)
       continue;
     pid = process->pid;
-    p = look_up_process_in_process_hash_table(pid);
+    p = look_up_process_in_process_hash_table(ctx, pid);
     *p = process;
   }
   free(old_process_hash_table);
 }
 
-static Process *find_process(int pid) {
+static Process *find_process(runlim_ctx *ctx, int pid) {
   Process *res, **p;
 
-  if (processes >= size_of_process_hash_table / 2)
-    resize_process_hash_table();
+  if (ctx->processes >= ctx->size_of_process_hash_table / 2)
+    resize_process_hash_table(ctx);
 
-  p = look_up_process_in_process_hash_table(pid);
+  p = look_up_process_in_process_hash_table(ctx, pid);
   assert(p);
   res = *p;
 
@@ -521,38 +1407,48 @@ static Process *find_process(int pid) {
     return res;
   }
 
-  debug("insert", "%d", pid);
+  debug(ctx, "insert", "%d", pid);
 
   res = malloc(sizeof *res);
   if (!res)
-    error("could not allocate process data");
+    error(ctx, "could not allocate process data");
 
   memset(res, 0, sizeof *res);
   res->pid = pid;
 
   *p = res;
-  processes++;
+  ctx->processes++;
 
   return res;
 }
 
-/*------------------------------------------------------------------------*/
+static void release_process_hash_table(runlim_ctx *ctx) {
+  if (!ctx->process_hash_table)
+    return;
+
+  for (size_t pos = 0; pos < ctx->size_of_process_hash_table; pos++)
+    if (ctx->process_hash_table[pos]) {
+      free(ctx->process_hash_table[pos]->cmdline);
+      free(ctx->process_hash_table[pos]);
+    }
 
-static Process *active_processes;
-static Process *last_active_process;
+  free(ctx->process_hash_table);
+  ctx->process_hash_table = 0;
+  ctx->size_of_process_hash_table = 0;
+  ctx->processes = 0;
+}
 
-static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-static volatile int killing;
+/*------------------------------------------------------------------------*/
 
-static void add_process(pid_t pid, pid_t ppid, pid_t pgrp, pid_t psession,
-			double time, double memory) {
+static Process *add_process(runlim_ctx *ctx, pid_t pid, pid_t ppid, pid_t pgrp,
+			    pid_t psession, double time, double memory) {
   const char *type;
   Process *p;
 
   assert(0 < pid);
   assert(0 <= ppid);
 
-  p = find_process(pid);
+  p = find_process(ctx, pid);
 
   if (p->active) {
     p->new = 0;
@@ -576,643 +1472,5575 @@ static void add_process(pid_t pid, pid_t ppid, pid_t pgrp, pid_t psession,
     p->psession = psession;
     p->time = time;
     p->memory = memory;
+    p->exited = 0;
+    p->exit_time = p->accounted = 0;
+    p->huge = p->huge_memory = 0;
     p->next_process = 0;
 
-    if (last_active_process)
-      last_active_process->next_process = p;
+    if (ctx->last_active_process)
+      ctx->last_active_process->next_process = p;
     else {
-      assert(!active_processes);
-      active_processes = p;
+      assert(!ctx->active_processes);
+      ctx->active_processes = p;
     }
 
-    last_active_process = p;
+    ctx->last_active_process = p;
   }
 
-  debug(type, "%d (parent %d, %.3f sec, %.3f MB)", pid, ppid, time, memory);
+  debug(ctx, type, "%d (parent %d, %.3f sec, %.3f MB)", pid, ppid, time,
+	memory);
+
+  p->sampled = ctx->num_samples;
 
-  p->sampled = num_samples;
+  return p;
 }
 
 /*------------------------------------------------------------------------*/
 
-#ifndef NDEBUG
-static int parsed;
-#endif
+/* Contention is measured per process through the run-queue wait time in
+ * 'schedstat' and the context switch counts in 'status', both only cover
+ * the main thread, and for the whole run through pressure stall
+ * information (system wide or of the cgroup in cgroup mode).
+ */
 
-#define FAILED                                                                 \
-  do {                                                                         \
-    fclose(file);                                                              \
-    return 0;                                                                  \
-  } while (0)
+static void read_contention(long pid, Process *p) {
+  unsigned long long run, wait;
+  char path[64], line[128];
+  FILE *file;
+  long value;
 
-#define READ(POS, TYPE, NAME, FMT)                                             \
-  TYPE NAME;                                                                   \
-  do {                                                                         \
-    if (fscanf(file, FMT, &NAME) != 1)                                         \
-      FAILED;                                                                  \
-    assert(++parsed == (POS));                                                 \
-  } while (0)
+  sprintf(path, "/proc/%ld/schedstat", pid);
+  file = fopen(path, "r");
+  if (file) {
+    if (fscanf(file, "%llu %llu", &run, &wait) == 2)
+      p->wait = 1e-9 * wait;
+    fclose(file);
+  }
 
-#define IGNR(POS, TYPE, NAME, FMT)                                             \
-  do {                                                                         \
-    TYPE NAME;                                                                 \
-    if (fscanf(file, FMT, &NAME) != 1)                                         \
-      FAILED;                                                                  \
-    (void)NAME;                                                                \
-    assert(++parsed == (POS));                                                 \
-  } while (0)
+  sprintf(path, "/proc/%ld/status", pid);
+  file = fopen(path, "r");
+  if (file) {
+    while (fgets(line, sizeof line, file)) {
+      if (sscanf(line, "voluntary_ctxt_switches: %ld", &value) == 1)
+	p->voluntary = value;
+      else if (sscanf(line, "nonvoluntary_ctxt_switches: %ld", &value) == 1)
+	p->involuntary = value;
+    }
+    fclose(file);
+  }
+}
 
-#define COMM(POS)                                                              \
-  do {                                                                         \
-    if (getc(file) != ' ')                                                     \
-      FAILED;                                                                  \
-    if (getc(file) != '(')                                                     \
-      FAILED;                                                                  \
-    int ch;                                                                    \
-    while ((ch = getc(file)) != ')')                                           \
-      if (ch == EOF)                                                           \
-	FAILED;                                                                \
-    assert(++parsed == (POS));                                                 \
-  } while (0)
+static const char *pressure_resources[PRESSURE_RESOURCES] = {"cpu", "memory",
+							     "io"};
 
-static int read_process(long pid) {
-  char path[64];
+static int read_pressure(runlim_ctx *ctx, const char *resource, double *some,
+			 double *full) {
+  unsigned long long total;
+  char path[PATH_MAX];
+  char line[256];
   FILE *file;
-  sprintf(path, "/proc/%ld/stat", pid);
+  int res = 0;
+
+  if (ctx->cgroup_path)
+    snprintf(path, sizeof path, "%s/%s.pressure", ctx->cgroup_path, resource);
+  else
+    snprintf(path, sizeof path, "/proc/pressure/%s", resource);
+
   file = fopen(path, "r");
   if (!file)
     return 0;
-#ifndef NDEBUG
-  parsed = 0;
-#endif
-  READ(1, int, rid, "%d");
-  if (rid != pid)
-    FAILED;
-  COMM(2);
-  if (getc(file) != ' ')
-    FAILED;
-  IGNR(3, char, state, "%c");
-  READ(4, int, ppid, "%d");
-  READ(5, int, pgrp, "%d");
-  READ(6, int, psession, "%d");
-  debug("read", "pid=%d ppid=%d pgrp=%d session=%d", pid, ppid, pgrp, psession);
-  if (!single && group_pid <= pid && pid < child_pid)
-    FAILED;
-  if (!single && session_pid <= pid && pid < child_pid)
-    FAILED;
-  if (pgrp != group_pid && psession != session_pid)
-    FAILED;
-  IGNR(7, int, tty_nr, "%d");
-  IGNR(8, int, tpgid, "%d");
-  IGNR(9, unsigned int, flags, "%u");
-  IGNR(10, unsigned long, minflt, "%lu");
-  IGNR(11, unsigned long, cminflt, "%lu");
-  IGNR(12, unsigned long, majflt, "%lu");
-  IGNR(13, unsigned long, cmajflt, "%lu");
-  READ(14, unsigned long, utime, "%lu");
-  if (utime < 0)
-    FAILED;
-  READ(15, unsigned long, stime, "%lu");
-  if (stime < 0)
-    FAILED;
-  IGNR(16, long, cutime, "%ld");
-  IGNR(17, long, cstime, "%ld");
-  IGNR(18, long, priority, "%ld");
-  IGNR(19, long, nice, "%ld");
-  IGNR(20, long, num_threads, "%ld");
-  IGNR(21, long, itrealvalue, "%ld");
-  IGNR(22, unsigned long long, starttime, "%llu");
-  IGNR(23, unsigned long, vsize, "%lu");
-  READ(24, long, rss, "%ld");
-  if (rss < 0)
-    FAILED;
+
+  *some = *full = 0;
+  while (fgets(line, sizeof line, file)) {
+    const char *p = strstr(line, "total=");
+    if (!p || sscanf(p, "total=%llu", &total) != 1)
+      continue;
+    if (!strncmp(line, "some", 4)) {
+      *some = 1e-6 * total;
+      res = 1;
+    } else if (!strncmp(line, "full", 4))
+      *full = 1e-6 * total;
+  }
+
   fclose(file);
-  debug("utime", "%f microseconds", utime);
-  debug("stime", "%f microseconds", stime);
-  const double time = (utime + stime) / (double)clock_ticks;
-  const double memory = rss * memory_per_page;
-  add_process(pid, ppid, pgrp, psession, time, memory);
-  return 1;
+
+  return res;
+}
+
+static void start_pressure(runlim_ctx *ctx) {
+  size_t i;
+  ctx->pressure_available = 1;
+  for (i = 0; i < PRESSURE_RESOURCES; i++)
+    if (!read_pressure(ctx, pressure_resources[i], ctx->pressure_some + i,
+		       ctx->pressure_full + i))
+      ctx->pressure_available = 0;
+  if (!ctx->pressure_available)
+    warning(ctx, "pressure stall information not available");
+}
+
+static void stop_pressure(runlim_ctx *ctx) {
+  double some, full;
+  size_t i;
+  if (!ctx->pressure_available)
+    return;
+  for (i = 0; i < PRESSURE_RESOURCES; i++) {
+    if (!read_pressure(ctx, pressure_resources[i], &some, &full)) {
+      ctx->pressure_available = 0;
+      return;
+    }
+    ctx->pressure_some[i] = some - ctx->pressure_some[i];
+    ctx->pressure_full[i] = full - ctx->pressure_full[i];
+  }
 }
 
 /*------------------------------------------------------------------------*/
 
-static void read_parent_status_and_mount_proc_file_system_if_necessary(void) {
-  char path[64];
+/* The effective frequency of the CPUs on which sampled processes were
+ * running during a sample (field 'processor' in 'stat') is read from
+ * 'cpufreq/cpuinfo_avg_freq' (based on APERF and MPERF if the kernel
+ * provides it) or otherwise 'cpufreq/scaling_cur_freq'.  The thermal
+ * throttle counters of those CPUs are read when a CPU is used for the
+ * first time and at the end of the run.
+ */
+
+#define THROTTLE_UNSEEN -1
+#define THROTTLE_UNAVAILABLE -2
+
+static void init_frequency(runlim_ctx *ctx) {
+  int cpu;
+  ctx->num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+  if (ctx->num_cpus <= 0)
+    ctx->num_cpus = 1;
+  ctx->cpus_in_sample = calloc(ctx->num_cpus, 1);
+  ctx->throttle_start = malloc(ctx->num_cpus * sizeof *ctx->throttle_start);
+  if (!ctx->cpus_in_sample || !ctx->throttle_start)
+    error(ctx, "out-of-memory allocating CPU frequency data");
+  for (cpu = 0; cpu < ctx->num_cpus; cpu++)
+    ctx->throttle_start[cpu] = THROTTLE_UNSEEN;
+  debug(ctx, "cpus", "%d", ctx->num_cpus);
+}
+
+static int read_cpu_number(runlim_ctx *ctx, int cpu, const char *name,
+			   long *res_ptr) {
+  char path[PATH_MAX];
+  FILE *file;
+  int res;
+  snprintf(path, sizeof path, "%s/devices/system/cpu/cpu%d/%s", ctx->sysfs_root,
+	   cpu, name);
+  file = fopen(path, "r");
+  if (!file)
+    return 0;
+  res = fscanf(file, "%ld", res_ptr) == 1;
+  fclose(file);
+  return res;
+}
+
+static long read_throttle_count(runlim_ctx *ctx, int cpu) {
+  long core, package;
+  if (!read_cpu_number(ctx, cpu, "thermal_throttle/core_throttle_count", &core))
+    return THROTTLE_UNAVAILABLE;
+  if (!read_cpu_number(ctx, cpu, "thermal_throttle/package_throttle_count",
+		       &package))
+    package = 0;
+  return core + package;
+}
+
+static void mark_processor(runlim_ctx *ctx, int cpu) {
+  if (0 <= cpu && cpu < ctx->num_cpus)
+    ctx->cpus_in_sample[cpu] = 1;
+}
+
+static void sample_frequency(runlim_ctx *ctx) {
+  double sum = 0, min = 0, frequency;
+  int cpu, cpus = 0;
+  long khz;
+
+  for (cpu = 0; cpu < ctx->num_cpus; cpu++) {
+    if (!ctx->cpus_in_sample[cpu])
+      continue;
+    ctx->cpus_in_sample[cpu] = 0;
+
+    if (ctx->throttle_start[cpu] == THROTTLE_UNSEEN)
+      ctx->throttle_start[cpu] = read_throttle_count(ctx, cpu);
+
+    if (!read_cpu_number(ctx, cpu, "cpufreq/cpuinfo_avg_freq", &khz) &&
+	!read_cpu_number(ctx, cpu, "cpufreq/scaling_cur_freq", &khz))
+      continue;
+
+    frequency = khz / 1e3;
+    debug(ctx, "frequency", "cpu %d %.0f MHz", cpu, frequency);
+    if (!cpus++ || frequency < min)
+      min = frequency;
+    sum += frequency;
+  }
+
+  if (!cpus)
+    return;
+
+  if (!ctx->frequency_samples++ || min < ctx->min_frequency)
+    ctx->min_frequency = min;
+  ctx->frequency_sum += sum / cpus;
+}
+
+static void report_frequency(runlim_ctx *ctx) {
+  long events = 0, count;
+  int cpu, cpus = 0;
+
+  if (ctx->frequency_samples)
+    message(ctx, "frequency", "%.0f MHz average, %.0f MHz minimum",
+	    ctx->frequency_sum / ctx->frequency_samples, ctx->min_frequency);
+  else
+    message(ctx, "frequency", "unknown");
+
+  for (cpu = 0; cpu < ctx->num_cpus; cpu++) {
+    if (ctx->throttle_start[cpu] < 0)
+      continue;
+    count = read_throttle_count(ctx, cpu);
+    if (count < 0)
+      continue;
+    events += count - ctx->throttle_start[cpu];
+    cpus++;
+  }
+
+  if (cpus)
+    message(ctx, "throttling", "%ld events", events);
+}
+
+static void release_frequency(runlim_ctx *ctx) {
+  free(ctx->cpus_in_sample);
+  free(ctx->throttle_start);
+}
+
+/*------------------------------------------------------------------------*/
+
+/* Minor and major page faults of a process include those of its reaped
+ * children ('cminflt' and 'cmajflt'), thus the sum over the sampled
+ * processes does not miss terminated processes as long as they were
+ * reaped by a sampled process.  At the end the faults reported by
+ * 'wait4' for the child are taken into account too.  With '--swap' the
+ * swapped out memory of each process is read from '/proc/<pid>/status'
+ * and with '--swap-in-space' it is also counted as part of the space
+ * which is checked against the space limit.
+ */
+
+static void read_swap(long pid, Process *p) {
+  char path[64], line[128];
+  FILE *file;
+  long kb;
+
+  sprintf(path, "/proc/%ld/status", pid);
+  file = fopen(path, "r");
+  if (!file)
+    return;
+  while (fgets(line, sizeof line, file))
+    if (sscanf(line, "VmSwap: %ld kB", &kb) == 1) {
+      p->swap = kb / 1024.0;
+      break;
+    }
+  fclose(file);
+}
+
+static void report_faults(runlim_ctx *ctx, double real, struct rusage *usage) {
+  long minor = ctx->max_minor_faults, major = ctx->max_major_faults;
+
+  if (usage->ru_minflt > minor)
+    minor = usage->ru_minflt;
+  if (usage->ru_majflt > major)
+    major = usage->ru_majflt;
+
+  message(ctx, "faults", "%ld minor (%.0f/s), %ld major (%.0f/s)", minor,
+	  real > 0 ? minor / real : 0, major, real > 0 ? major / real : 0);
+
+  if (ctx->swap)
+    message(ctx, "swap", "%.0f MB maximum", ctx->max_swap);
+}
+
+/*------------------------------------------------------------------------*/
+
+/* With '--thp=never' transparent huge pages are disabled for the program
+ * with 'PR_SET_THP_DISABLE' (which is inherited by its children), while
+ * '--thp=always' clears an inherited disable flag.  Per process huge pages
+ * can only be disabled, thus whether they are used for 'always' still
+ * depends on the system wide setting, which is reported in the header.
+ * With any '--thp' option the 'AnonHugePages' in '/proc/<pid>/smaps_rollup'
+ * of sampled processes are summed up and the peak is reported together
+ * with the difference of the system wide huge page counters in
+ * '/proc/vmstat' over the run.  Since 'smaps_rollup' walks all mappings
+ * of a process, which is costly for large processes, it is only read for
+ * new processes, when a report is due and when the memory of the process
+ * grew by 'HUGE_PAGES_GROWTH' since the last read (in between the last
+ * read value is used).  Thus the peak is caught while memory grows.
+ */
+
+#define HUGE_PAGES_GROWTH 1.1
+
+enum { THP_NONE = 0, THP_INHERIT = 1, THP_ALWAYS = 2, THP_NEVER = 3 };
+
+static const char *thp_counter_names[THP_COUNTERS] = {
+    "thp_fault_alloc", "thp_fault_fallback", "thp_collapse_alloc",
+    "thp_collapse_alloc_failed", "thp_split_page"};
+
+static const char *thp_name(runlim_ctx *ctx) {
+  switch (ctx->thp) {
+  case THP_ALWAYS:
+    return "always";
+  case THP_NEVER:
+    return "never";
+  default:
+    return "inherit";
+  }
+}
+
+static const char *read_system_thp(runlim_ctx *ctx, char *res, size_t size) {
+  char path[PATH_MAX], line[128];
+  const char *p, *q;
+  FILE *file;
+
+  snprintf(path, sizeof path, "%s/kernel/mm/transparent_hugepage/enabled",
+	   ctx->sysfs_root);
+  file = fopen(path, "r");
+  if (!file)
+    return "unknown";
+  if (!fgets(line, sizeof line, file))
+    line[0] = 0;
+  fclose(file);
+
+  p = strchr(line, '[');
+  q = p ? strchr(p, ']') : 0;
+  if (!q || q - p - 1 >= (long)size)
+    return "unknown";
+  memcpy(res, p + 1, q - p - 1);
+  res[q - p - 1] = 0;
+  return res;
+}
+
+static void read_huge_pages(long pid, Process *p) {
+  char path[64], line[128];
+  FILE *file;
+  long kb;
+
+  sprintf(path, "/proc/%ld/smaps_rollup", pid);
+  file = fopen(path, "r");
+  if (!file)
+    return;
+  while (fgets(line, sizeof line, file))
+    if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1) {
+      p->huge = kb / 1024.0;
+      break;
+    }
+  fclose(file);
+}
+
+static void read_thp_counters(long long *counters) {
+  char line[128], name[64];
+  long long value;
+  FILE *file;
+  size_t i;
+
+  memset(counters, 0, THP_COUNTERS * sizeof *counters);
+
+  file = fopen("/proc/vmstat", "r");
+  if (!file)
+    return;
+  while (fgets(line, sizeof line, file)) {
+    if (sscanf(line, "%63s %lld", name, &value) != 2)
+      continue;
+    for (i = 0; i < THP_COUNTERS; i++)
+      if (!strcmp(name, thp_counter_names[i]))
+	counters[i] = value;
+  }
+  fclose(file);
+}
+
+static void start_thp(runlim_ctx *ctx) { read_thp_counters(ctx->thp_counters); }
+
+static void report_thp(runlim_ctx *ctx) {
+  long long counters[THP_COUNTERS];
+  size_t i;
+
+  read_thp_counters(counters);
+  for (i = 0; i < THP_COUNTERS; i++)
+    counters[i] -= ctx->thp_counters[i];
+
+  message(ctx, "huge pages", "%.0f MB maximum", ctx->max_huge);
+  message(ctx, "thp faults", "%lld allocated, %lld fallback", counters[0],
+	  counters[1]);
+  message(ctx, "thp collapses", "%lld allocated, %lld failed", counters[2],
+	  counters[3]);
+  message(ctx, "thp splits", "%lld", counters[4]);
+}
+
+// Called in the child before executing the program.  Returns zero or the
+// 'errno' of the failed 'prctl', which the child passes on to the parent
+// through the exec pipe (see 'run_program').
+
+static int apply_thp(runlim_ctx *ctx) {
+  int res = 0;
+  if (ctx->thp == THP_NEVER)
+    res = prctl(PR_SET_THP_DISABLE, 1, 0, 0, 0);
+  else if (ctx->thp == THP_ALWAYS)
+    res = prctl(PR_SET_THP_DISABLE, 0, 0, 0, 0);
+  return res < 0 ? errno : 0;
+}
+
+// The header is printed before the child applies the policy.  Setting the
+// per process flag fails exactly if reading it fails (on kernels before
+// 3.15 or if 'prctl' is filtered), which is thus checked in the parent.
+
+static const char *thp_support(runlim_ctx *ctx) {
+  if (ctx->thp != THP_NEVER && ctx->thp != THP_ALWAYS)
+    return "";
+  if (prctl(PR_GET_THP_DISABLE, 0, 0, 0, 0) < 0)
+    return ", not supported";
+  return "";
+}
+
+/*------------------------------------------------------------------------*/
+
+/* With '--io' the I/O counters in '/proc/<pid>/io' are read for each
+ * sampled process.  In contrast to process time these counters include
+ * those of reaped children.  Thus the counters of a terminated process are
+ * only accumulated if its parent is not part of the job (as for the child
+ * process of 'runlim' and orphans), since otherwise they show up again in
+ * the counters of the parent after reaping it.  The peak read and write
+ * rates are computed from the difference of the total number of bytes read
+ * and written between consecutive samples.
+ */
+
+static void read_io(long pid, Process *p) {
+  char path[64], line[128];
+  long long value;
+  FILE *file;
+
+  sprintf(path, "/proc/%ld/io", pid);
+  file = fopen(path, "r");
+  if (!file)
+    return;
+  while (fgets(line, sizeof line, file)) {
+    if (sscanf(line, "rchar: %lld", &value) == 1)
+      p->io.rchar = value;
+    else if (sscanf(line, "wchar: %lld", &value) == 1)
+      p->io.wchar = value;
+    else if (sscanf(line, "syscr: %lld", &value) == 1)
+      p->io.syscr = value;
+    else if (sscanf(line, "syscw: %lld", &value) == 1)
+      p->io.syscw = value;
+    else if (sscanf(line, "read_bytes: %lld", &value) == 1)
+      p->io.read_bytes = value;
+    else if (sscanf(line, "write_bytes: %lld", &value) == 1)
+      p->io.write_bytes = value;
+  }
+  fclose(file);
+}
+
+static void add_io(IO *a, const IO *b) {
+  a->rchar += b->rchar;
+  a->wchar += b->wchar;
+  a->syscr += b->syscr;
+  a->syscw += b->syscw;
+  a->read_bytes += b->read_bytes;
+  a->write_bytes += b->write_bytes;
+}
+
+static void max_io_counters(IO *a, const IO *b) {
+  if (b->rchar > a->rchar)
+    a->rchar = b->rchar;
+  if (b->wchar > a->wchar)
+    a->wchar = b->wchar;
+  if (b->syscr > a->syscr)
+    a->syscr = b->syscr;
+  if (b->syscw > a->syscw)
+    a->syscw = b->syscw;
+  if (b->read_bytes > a->read_bytes)
+    a->read_bytes = b->read_bytes;
+  if (b->write_bytes > a->write_bytes)
+    a->write_bytes = b->write_bytes;
+}
+
+static void sample_io(runlim_ctx *ctx, double now) {
+  double delta, rate;
+
+  max_io_counters(&ctx->max_io, &ctx->sampled_io);
+
+  if (!ctx->last_io_time)
+    ctx->last_io_time = ctx->start_time;
+  delta = now - ctx->last_io_time;
+
+  if (delta > 0) {
+    rate = (ctx->max_io.rchar - ctx->last_io.rchar) / delta / (1 << 20);
+    if (rate > ctx->max_read_rate)
+      ctx->max_read_rate = rate;
+    rate = (ctx->max_io.wchar - ctx->last_io.wchar) / delta / (1 << 20);
+    if (rate > ctx->max_write_rate)
+      ctx->max_write_rate = rate;
+  }
+
+  ctx->last_io = ctx->max_io;
+  ctx->last_io_time = now;
+}
+
+static void reset_io(runlim_ctx *ctx) {
+  memset(&ctx->accumulated_io, 0, sizeof ctx->accumulated_io);
+  memset(&ctx->max_io, 0, sizeof ctx->max_io);
+  memset(&ctx->last_io, 0, sizeof ctx->last_io);
+  ctx->last_io_time = ctx->max_read_rate = ctx->max_write_rate = 0;
+}
+
+static void report_io(runlim_ctx *ctx) {
+  message(ctx, "read", "%.1f MB (%.1f MB from storage, %lld calls)",
+	  ctx->max_io.rchar / (double)(1 << 20),
+	  ctx->max_io.read_bytes / (double)(1 << 20), ctx->max_io.syscr);
+  message(ctx, "written", "%.1f MB (%.1f MB to storage, %lld calls)",
+	  ctx->max_io.wchar / (double)(1 << 20),
+	  ctx->max_io.write_bytes / (double)(1 << 20), ctx->max_io.syscw);
+  message(ctx, "io rate", "%.1f MB/s read, %.1f MB/s written maximum",
+	  ctx->max_read_rate, ctx->max_write_rate);
+}
+
+/*------------------------------------------------------------------------*/
+
+/* With '--breakdown' the process records keep the command name, peak
+ * resident set size and last sampled process time of each process (even
+ * after it terminated).  At the end of a run the processes using most
+ * time and most memory are listed as well as aggregated numbers per
+ * executable (command name).  With '--cmdline' the arguments are read
+ * from '/proc/<pid>/cmdline' whenever the command name changes and shown
+ * instead of the command name.
+ */
+
+typedef struct Executable Executable;
+
+struct Executable {
+  const char *name;
+  long processes;
+  double time;
+  double memory;
+};
+
+static char *read_cmdline(runlim_ctx *ctx, long pid) {
+  char path[64], *res;
+  size_t bytes, i;
   FILE *file;
 
-  sprintf(path, "/proc/%ld/stat", (long)parent_pid);
-  file = fopen(path, "r");
-  if (file)
-    fclose(file);
-  else
-    (void)try_to_remount_proc_file_system();
+  sprintf(path, "/proc/%ld/cmdline", pid);
+  file = fopen(path, "r");
+  if (!file)
+    return 0;
+
+  res = malloc(CMDLINE_SIZE);
+  if (!res)
+    error(ctx, "out-of-memory reading command line");
+  bytes = fread(res, 1, CMDLINE_SIZE - 1, file);
+  fclose(file);
+
+  while (bytes && !res[bytes - 1])
+    bytes--;
+  if (!bytes) {
+    free(res);
+    return 0;
+  }
+
+  for (i = 0; i < bytes; i++)
+    if (!res[i])
+      res[i] = ' ';
+  res[bytes] = 0;
+
+  return res;
+}
+
+static void update_process_name(runlim_ctx *ctx, Process *p, const char *comm) {
+  if (p->new)
+    p->counted = 0;
+  if (p->new || p->memory > p->peak_memory)
+    p->peak_memory = p->memory;
+  if (!p->new && !strcmp(p->comm, comm))
+    return;
+  strcpy(p->comm, comm);
+  if (!ctx->show_cmdline)
+    return;
+  free(p->cmdline);
+  p->cmdline = read_cmdline(ctx, p->pid);
+}
+
+static const char *process_name(Process *p) {
+  return p->cmdline ? p->cmdline : p->comm;
+}
+
+static int cmp_process_time(const void *p, const void *q) {
+  const Process *a = *(Process *const *)p, *b = *(Process *const *)q;
+  if (a->time != b->time)
+    return a->time < b->time ? 1 : -1;
+  return a->pid - b->pid;
+}
+
+static int cmp_process_memory(const void *p, const void *q) {
+  const Process *a = *(Process *const *)p, *b = *(Process *const *)q;
+  if (a->peak_memory != b->peak_memory)
+    return a->peak_memory < b->peak_memory ? 1 : -1;
+  return a->pid - b->pid;
+}
+
+static int cmp_process_comm(const void *p, const void *q) {
+  const Process *a = *(Process *const *)p, *b = *(Process *const *)q;
+  return strcmp(a->comm, b->comm);
+}
+
+static int cmp_executable_time(const void *p, const void *q) {
+  const Executable *a = p, *b = q;
+  if (a->time != b->time)
+    return a->time < b->time ? 1 : -1;
+  return strcmp(a->name, b->name);
+}
+
+static void report_breakdown(runlim_ctx *ctx) {
+  Executable *executables;
+  long count = 0, i, j, k;
+  char name[32];
+  Process **p;
+  size_t pos;
+
+  p = malloc(ctx->processes * sizeof *p);
+  executables = malloc(ctx->processes * sizeof *executables);
+  if (!p || !executables)
+    error(ctx, "out-of-memory allocating process breakdown");
+
+  for (pos = 0; pos < ctx->size_of_process_hash_table; pos++)
+    if (ctx->process_hash_table[pos] && ctx->process_hash_table[pos]->counted)
+      p[count++] = ctx->process_hash_table[pos];
+
+  qsort(p, count, sizeof *p, cmp_process_time);
+  for (i = 0; i < count && i < ctx->breakdown; i++) {
+    sprintf(name, "time[%ld]", i + 1);
+    message(ctx, name, "%.2f seconds %d %s", p[i]->time, p[i]->pid,
+	    process_name(p[i]));
+  }
+
+  qsort(p, count, sizeof *p, cmp_process_memory);
+  for (i = 0; i < count && i < ctx->breakdown; i++) {
+    sprintf(name, "space[%ld]", i + 1);
+    message(ctx, name, "%.0f MB %d %s", p[i]->peak_memory, p[i]->pid,
+	    process_name(p[i]));
+  }
+
+  qsort(p, count, sizeof *p, cmp_process_comm);
+  for (i = k = 0; i < count; i = j, k++) {
+    executables[k].name = p[i]->comm;
+    executables[k].processes = 0;
+    executables[k].time = executables[k].memory = 0;
+    for (j = i; j < count && !strcmp(p[i]->comm, p[j]->comm); j++) {
+      executables[k].processes++;
+      executables[k].time += p[j]->time;
+      if (p[j]->peak_memory > executables[k].memory)
+	executables[k].memory = p[j]->peak_memory;
+    }
+  }
+
+  qsort(executables, k, sizeof *executables, cmp_executable_time);
+  for (i = 0; i < k && i < ctx->breakdown; i++) {
+    sprintf(name, "executable[%ld]", i + 1);
+    message(ctx, name, "%.2f seconds %.0f MB %ld processes %s",
+	    executables[i].time, executables[i].memory,
+	    executables[i].processes, executables[i].name);
+  }
+
+  free(executables);
+  free(p);
+}
+
+/*------------------------------------------------------------------------*/
+
+/* With '--taskstats' exit records of tasks are received from the generic
+ * netlink 'taskstats' family (registering needs 'CAP_NET_ADMIN').  Each
+ * exiting thread yields a record with its run time in nanoseconds, the high
+ * water mark of the resident set size and the delay accounting totals.  A
+ * record is attributed to the process of its thread group if that process
+ * belongs to the job, or otherwise if its parent does (or it is the child
+ * or one of its children), which also catches processes exiting before
+ * they were sampled.  After the record of the main
+ * thread arrived the time of an inactive process is the sum of the run
+ * times of its threads instead of its last sampled time.  Live single
+ * threaded processes read their run time in nanoseconds from 'schedstat'
+ * instead of clock ticks from 'stat'.
+ */
+
+static void read_run_time(long pid, double *time_ptr) {
+  unsigned long long run;
+  char path[64];
+  FILE *file;
+
+  sprintf(path, "/proc/%ld/schedstat", pid);
+  file = fopen(path, "r");
+  if (!file)
+    return;
+  if (fscanf(file, "%llu", &run) == 1)
+    *time_ptr = 1e-9 * run;
+  fclose(file);
+}
+
+static void *attribute_data(struct nlattr *na) {
+  return (char *)na + NLA_HDRLEN;
+}
+
+static long attribute_size(struct nlattr *na) {
+  return (long)na->nla_len - NLA_HDRLEN;
+}
+
+static struct nlattr *find_attribute(void *data, long size, int type) {
+  struct nlattr *na = data;
+  while (size >= NLA_HDRLEN && na->nla_len >= NLA_HDRLEN &&
+	 na->nla_len <= size) {
+    if ((na->nla_type & NLA_TYPE_MASK) == type)
+      return na;
+    size -= NLA_ALIGN(na->nla_len);
+    na = (struct nlattr *)((char *)na + NLA_ALIGN(na->nla_len));
+  }
+  return 0;
+}
+
+static int send_genetlink(runlim_ctx *ctx, int type, int flags, int cmd,
+			  int attr, const void *data, size_t size) {
+  struct {
+    struct nlmsghdr header;
+    struct genlmsghdr genl;
+    char attributes[64];
+  } request;
+  struct sockaddr_nl kernel;
+  struct nlattr *na;
+
+  assert(NLA_HDRLEN + size <= sizeof request.attributes);
+
+  memset(&request, 0, sizeof request);
+  request.header.nlmsg_type = type;
+  request.header.nlmsg_flags = NLM_F_REQUEST | flags;
+  request.genl.cmd = cmd;
+  request.genl.version = 1;
+  na = (struct nlattr *)request.attributes;
+  na->nla_type = attr;
+  na->nla_len = NLA_HDRLEN + size;
+  memcpy(attribute_data(na), data, size);
+  request.header.nlmsg_len =
+      NLMSG_LENGTH(GENL_HDRLEN) + NLA_ALIGN(na->nla_len);
+
+  memset(&kernel, 0, sizeof kernel);
+  kernel.nl_family = AF_NETLINK;
+
+  return sendto(ctx->taskstats_socket, &request, request.header.nlmsg_len, 0,
+		(struct sockaddr *)&kernel,
+		sizeof kernel) == (ssize_t)request.header.nlmsg_len;
+}
+
+static struct nlmsghdr *receive_genetlink(runlim_ctx *ctx, char *buffer,
+					  size_t size) {
+  struct nlmsghdr *header = (struct nlmsghdr *)buffer;
+  ssize_t len;
+
+  while ((len = recv(ctx->taskstats_socket, buffer, size, 0)) < 0 &&
+	 errno == EINTR)
+    ;
+  if (len < 0 || !NLMSG_OK(header, (size_t)len))
+    return 0;
+  return header;
+}
+
+static int resolve_taskstats_family(runlim_ctx *ctx) {
+  struct nlmsghdr *header;
+  char buffer[1 << 12];
+  struct nlattr *na;
+
+  if (!send_genetlink(ctx, GENL_ID_CTRL, 0, CTRL_CMD_GETFAMILY,
+		      CTRL_ATTR_FAMILY_NAME, TASKSTATS_GENL_NAME,
+		      sizeof TASKSTATS_GENL_NAME))
+    return 0;
+
+  header = receive_genetlink(ctx, buffer, sizeof buffer);
+  if (!header || header->nlmsg_type == NLMSG_ERROR)
+    return 0;
+
+  na = find_attribute((char *)NLMSG_DATA(header) + GENL_HDRLEN,
+		      header->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN),
+		      CTRL_ATTR_FAMILY_ID);
+  if (!na || attribute_size(na) < (long)sizeof(uint16_t))
+    return 0;
+
+  return *(uint16_t *)attribute_data(na);
+}
+
+static int register_taskstats(runlim_ctx *ctx) {
+  struct nlmsghdr *header;
+  char buffer[1 << 12];
+  char mask[32];
+
+  sprintf(mask, "0-%ld", sysconf(_SC_NPROCESSORS_CONF) - 1);
+  if (!send_genetlink(ctx, ctx->taskstats_family, NLM_F_ACK, TASKSTATS_CMD_GET,
+		      TASKSTATS_CMD_ATTR_REGISTER_CPUMASK, mask,
+		      strlen(mask) + 1))
+    return 0;
+
+  header = receive_genetlink(ctx, buffer, sizeof buffer);
+  if (!header || header->nlmsg_type != NLMSG_ERROR)
+    return 0;
+
+  return !((struct nlmsgerr *)NLMSG_DATA(header))->error;
+}
+
+static void stop_taskstats(runlim_ctx *ctx) {
+  if (ctx->taskstats_socket < 0)
+    return;
+  (void)close(ctx->taskstats_socket);
+  ctx->taskstats_socket = -1;
+}
+
+static void start_taskstats(runlim_ctx *ctx) {
+  struct sockaddr_nl local;
+  int size = TASKSTATS_BUFFER;
+  long enabled;
+  FILE *file;
+
+  ctx->taskstats_exits = ctx->taskstats_lost = 0;
+  ctx->taskstats_user = ctx->taskstats_system = ctx->max_hiwater = 0;
+  ctx->cpu_delay = ctx->blkio_delay = ctx->swapin_delay = 0;
+
+  ctx->taskstats_socket =
+      socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+  if (ctx->taskstats_socket < 0) {
+    warning(ctx, "can not open netlink socket (taskstats disabled)");
+    return;
+  }
+
+  if (setsockopt(ctx->taskstats_socket, SOL_SOCKET, SO_RCVBUFFORCE, &size,
+		 sizeof size))
+    (void)setsockopt(ctx->taskstats_socket, SOL_SOCKET, SO_RCVBUF, &size,
+		     sizeof size);
+
+  memset(&local, 0, sizeof local);
+  local.nl_family = AF_NETLINK;
+  if (bind(ctx->taskstats_socket, (struct sockaddr *)&local, sizeof local)) {
+    warning(ctx, "can not bind netlink socket (taskstats disabled)");
+    stop_taskstats(ctx);
+    return;
+  }
+
+  ctx->taskstats_family = resolve_taskstats_family(ctx);
+  if (!ctx->taskstats_family) {
+    warning(ctx, "taskstats family not available (taskstats disabled)");
+    stop_taskstats(ctx);
+    return;
+  }
+
+  if (!register_taskstats(ctx)) {
+    warning(ctx, "can not register for taskstats (needs 'CAP_NET_ADMIN')");
+    stop_taskstats(ctx);
+    return;
+  }
+
+  (void)fcntl(ctx->taskstats_socket, F_SETFL, O_NONBLOCK);
+
+  file = fopen("/proc/sys/kernel/task_delayacct", "r");
+  if (file) {
+    if (fscanf(file, "%ld", &enabled) == 1 && !enabled)
+      warning(ctx, "delay accounting disabled (see 'kernel.task_delayacct')");
+    fclose(file);
+  }
+}
+
+static Process *job_process(runlim_ctx *ctx, int pid) {
+  Process *p;
+  if (!ctx->size_of_process_hash_table)
+    return 0;
+  p = *look_up_process_in_process_hash_table(ctx, pid);
+  return p && p->counted ? p : 0;
+}
+
+static long account_task_exit(runlim_ctx *ctx, const void *data, long size) {
+  struct taskstats stats;
+  double time, hiwater;
+  Process *p;
+  int tgid;
+
+  if (size <= 0)
+    return 0;
+
+  memset(&stats, 0, sizeof stats);
+  memcpy(&stats, data, size < (long)sizeof stats ? size : (long)sizeof stats);
+
+  if (size >= (long)(offsetof(struct taskstats, ac_tgid) +
+		     sizeof stats.ac_tgid))
+    tgid = stats.ac_tgid;
+  else
+    tgid = stats.ac_pid;
+  if (tgid <= 0)
+    return 0;
+
+  p = job_process(ctx, tgid);
+  if (!p) {
+    if (tgid != ctx->child_pid && (int)stats.ac_ppid != ctx->child_pid &&
+	!job_process(ctx, stats.ac_ppid))
+      return 0;
+    p = find_process(ctx, tgid);
+    p->counted = 1;
+    p->ppid = stats.ac_ppid;
+    memcpy(p->comm, stats.ac_comm, sizeof p->comm - 1);
+    p->comm[sizeof p->comm - 1] = 0;
+  }
+
+  if (stats.cpu_run_real_total)
+    time = 1e-9 * stats.cpu_run_real_total;
+  else
+    time = 1e-6 * (stats.ac_utime + stats.ac_stime);
+
+  p->exit_time += time;
+  if ((int)stats.ac_pid == tgid)
+    p->exited = 1;
+
+  hiwater = stats.hiwater_rss / 1024.0;
+  if (hiwater > p->peak_memory)
+    p->peak_memory = hiwater;
+  if (hiwater > ctx->max_hiwater)
+    ctx->max_hiwater = hiwater;
+
+  ctx->taskstats_exits++;
+  ctx->taskstats_user += 1e-6 * stats.ac_utime;
+  ctx->taskstats_system += 1e-6 * stats.ac_stime;
+  ctx->cpu_delay += 1e-9 * stats.cpu_delay_total;
+  ctx->blkio_delay += 1e-9 * stats.blkio_delay_total;
+  ctx->swapin_delay += 1e-9 * stats.swapin_delay_total;
+
+  if (!p->active && p->exited) {
+    ctx->accumulated_time += p->exit_time - p->accounted;
+    p->accounted = p->time = p->exit_time;
+  }
+
+  debug(ctx, "taskstats", "%u of %d (%.6f sec)", stats.ac_pid, tgid, time);
+
+  return 1;
+}
+
+static long drain_taskstats(runlim_ctx *ctx) {
+  struct nlattr *aggregate, *stats;
+  struct nlmsghdr *header;
+  char buffer[1 << 14];
+  long res = 0;
+  int len;
+
+  for (;;) {
+    len = recv(ctx->taskstats_socket, buffer, sizeof buffer, MSG_DONTWAIT);
+    if (len < 0) {
+      if (errno == ENOBUFS) {
+	ctx->taskstats_lost++;
+	continue;
+      }
+      if (errno == EINTR)
+	continue;
+      break;
+    }
+    for (header = (struct nlmsghdr *)buffer; NLMSG_OK(header, len);
+	 header = NLMSG_NEXT(header, len)) {
+      if (header->nlmsg_type != ctx->taskstats_family)
+	continue;
+      aggregate = find_attribute((char *)NLMSG_DATA(header) + GENL_HDRLEN,
+				 header->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN),
+				 TASKSTATS_TYPE_AGGR_PID);
+      if (!aggregate)
+	continue;
+      stats = find_attribute(attribute_data(aggregate),
+			     attribute_size(aggregate), TASKSTATS_TYPE_STATS);
+      if (stats)
+	res += account_task_exit(ctx, attribute_data(stats),
+				 attribute_size(stats));
+    }
+  }
+
+  return res;
+}
+
+static void report_taskstats(runlim_ctx *ctx) {
+  message(ctx, "taskstats", "%ld exits, %.3f user, %.3f system seconds",
+	  ctx->taskstats_exits, ctx->taskstats_user, ctx->taskstats_system);
+  message(ctx, "hiwater", "%.0f MB maximum", ctx->max_hiwater);
+  message(ctx, "delays", "%.3f cpu, %.3f block I/O, %.3f swap in seconds",
+	  ctx->cpu_delay, ctx->blkio_delay, ctx->swapin_delay);
+  if (ctx->taskstats_lost)
+    warning(ctx, "lost taskstats records %ld times (receive buffer overflow)",
+	    ctx->taskstats_lost);
+}
+
+/*------------------------------------------------------------------------*/
+
+/* Process identifiers are reused.  Thus processes are identified by their
+ * process identifier and start time (in clock ticks since boot).  If the
+ * start time of an active process changed, the previous process exited
+ * between two samples.  Its record is retired, i.e., its values are
+ * accumulated as if it was flushed, and it is added again for the new one.
+ */
+
+static void accumulate_process(runlim_ctx *ctx, Process *p) {
+  if (p->exited)
+    p->time = p->exit_time;
+  p->accounted = p->time;
+  ctx->accumulated_time += p->time;
+  ctx->accumulated_wait += p->wait;
+  ctx->accumulated_voluntary += p->voluntary;
+  ctx->accumulated_involuntary += p->involuntary;
+  if (!job_process(ctx, p->ppid))
+    add_io(&ctx->accumulated_io, &p->io);
+}
+
+static void retire_process(runlim_ctx *ctx, Process *p) {
+  Process *prev = 0, *q;
+
+  debug(ctx, "retire", "%d (%.3f sec, reused)", p->pid, p->time);
+  accumulate_process(ctx, p);
+
+  // Deactivate the record, such that 'add_process' adds the new process
+  // from scratch (with its own group and session in particular).
+
+  for (q = ctx->active_processes; q != p; q = q->next_process)
+    prev = q;
+  if (prev)
+    prev->next_process = p->next_process;
+  else
+    ctx->active_processes = p->next_process;
+  if (ctx->last_active_process == p)
+    ctx->last_active_process = prev;
+  p->next_process = 0;
+  p->active = 0;
+
+  p->counted = p->exited = 0;
+  p->exit_time = p->accounted = 0;
+  p->wait = 0;
+  p->voluntary = p->involuntary = 0;
+  memset(&p->io, 0, sizeof p->io);
+  p->peak_memory = 0;
+  free(p->cmdline);
+  p->cmdline = 0;
+  p->comm[0] = 0;
+}
+
+/*------------------------------------------------------------------------*/
+
+#define FAILED                                                                 \
+  do {                                                                         \
+    fclose(file);                                                              \
+    return 0;                                                                  \
+  } while (0)
+
+#define READ(POS, TYPE, NAME, FMT)                                             \
+  TYPE NAME;                                                                   \
+  do {                                                                         \
+    if (fscanf(file, FMT, &NAME) != 1)                                         \
+      FAILED;                                                                  \
+    assert(++parsed == (POS));                                                 \
+  } while (0)
+
+#define IGNR(POS, TYPE, NAME, FMT)                                             \
+  do {                                                                         \
+    TYPE NAME;                                                                 \
+    if (fscanf(file, FMT, &NAME) != 1)                                         \
+      FAILED;                                                                  \
+    (void)NAME;                                                                \
+    assert(++parsed == (POS));                                                 \
+  } while (0)
+
+#define COMM(POS, NAME)                                                        \
+  char NAME[sizeof ((Process *)0)->comm];                                      \
+  do {                                                                         \
+    if (getc(file) != ' ')                                                     \
+      FAILED;                                                                  \
+    if (getc(file) != '(')                                                     \
+      FAILED;                                                                  \
+    size_t len = 0;                                                            \
+    int ch;                                                                    \
+    while ((ch = getc(file)) != ')') {                                         \
+      if (ch == EOF)                                                           \
+	FAILED;                                                                \
+      if (len + 1 < sizeof NAME)                                               \
+	NAME[len++] = ch;                                                      \
+    }                                                                          \
+    NAME[len] = 0;                                                             \
+    assert(++parsed == (POS));                                                 \
+  } while (0)
+
+static int read_process(runlim_ctx *ctx, long pid) {
+#ifndef NDEBUG
+  int parsed = 0;
+#endif
+  char path[64];
+  FILE *file;
+  sprintf(path, "/proc/%ld/stat", pid);
+  file = fopen(path, "r");
+  if (!file)
+    return 0;
+  READ(1, int, rid, "%d");
+  if (rid != pid)
+    FAILED;
+  COMM(2, comm);
+  if (getc(file) != ' ')
+    FAILED;
+  IGNR(3, char, state, "%c");
+  READ(4, int, ppid, "%d");
+  READ(5, int, pgrp, "%d");
+  READ(6, int, psession, "%d");
+  debug(ctx, "read", "pid=%d ppid=%d pgrp=%d session=%d", pid, ppid, pgrp,
+	psession);
+  if (!ctx->single && ctx->group_pid <= pid && pid < ctx->child_pid)
+    FAILED;
+  if (!ctx->single && ctx->session_pid <= pid && pid < ctx->child_pid)
+    FAILED;
+  if (pgrp != ctx->group_pid && psession != ctx->session_pid)
+    FAILED;
+  IGNR(7, int, tty_nr, "%d");
+  IGNR(8, int, tpgid, "%d");
+  IGNR(9, unsigned int, flags, "%u");
+  READ(10, unsigned long, minflt, "%lu");
+  READ(11, unsigned long, cminflt, "%lu");
+  READ(12, unsigned long, majflt, "%lu");
+  READ(13, unsigned long, cmajflt, "%lu");
+  READ(14, unsigned long, utime, "%lu");
+  if (utime < 0)
+    FAILED;
+  READ(15, unsigned long, stime, "%lu");
+  if (stime < 0)
+    FAILED;
+  IGNR(16, long, cutime, "%ld");
+  IGNR(17, long, cstime, "%ld");
+  IGNR(18, long, priority, "%ld");
+  IGNR(19, long, nice, "%ld");
+  READ(20, long, num_threads, "%ld");
+  IGNR(21, long, itrealvalue, "%ld");
+  READ(22, unsigned long long, starttime, "%llu");
+  IGNR(23, unsigned long, vsize, "%lu");
+  READ(24, long, rss, "%ld");
+  if (rss < 0)
+    FAILED;
+  int processor = -1;
+  if (ctx->cpu_frequency) {
+    for (int pos = RSS_POS + 1; pos < PROCESSOR_POS; pos++)
+      if (fscanf(file, "%*s") == EOF)
+	break;
+    if (fscanf(file, "%d", &processor) != 1)
+      processor = -1;
+  }
+  fclose(file);
+  debug(ctx, "utime", "%f microseconds", utime);
+  debug(ctx, "stime", "%f microseconds", stime);
+  double time = (utime + stime) / (double)ctx->clock_ticks;
+  if (ctx->taskstats_socket >= 0 && num_threads == 1)
+    read_run_time(pid, &time);
+  const double memory = rss * ctx->memory_per_page;
+  Process *p = find_process(ctx, pid);
+  if (p->active && p->start != starttime)
+    retire_process(ctx, p);
+  p = add_process(ctx, pid, ppid, pgrp, psession, time, memory);
+  p->start = starttime;
+  p->processor = processor;
+  p->threads = num_threads;
+  p->minor_faults = minflt + cminflt;
+  p->major_faults = majflt + cmajflt;
+  if (ctx->swap)
+    read_swap(pid, p);
+  if (ctx->io_accounting)
+    read_io(pid, p);
+  if (ctx->thp && (ctx->huge_pages_due ||
+		   memory > HUGE_PAGES_GROWTH * p->huge_memory)) {
+    read_huge_pages(pid, p);
+    p->huge_memory = memory;
+  }
+  if (ctx->contention)
+    read_contention(pid, p);
+  if (ctx->breakdown)
+    update_process_name(ctx, p, comm);
+  return 1;
+}
+
+/*------------------------------------------------------------------------*/
+
+static void
+read_parent_status_and_mount_proc_file_system_if_necessary(runlim_ctx *ctx) {
+  char path[64];
+  FILE *file;
+
+  sprintf(path, "/proc/%ld/stat", (long)ctx->parent_pid);
+  file = fopen(path, "r");
+  if (file)
+    fclose(file);
+  else
+    (void)try_to_remount_proc_file_system(ctx);
+}
+
+static long read_all_processes(runlim_ctx *ctx) {
+  struct dirent *de;
+  long pid;
+  DIR *dir;
+
+  long res = 0;
+
+  dir = opendir("/proc");
+  if (!dir) {
+    if (try_to_remount_proc_file_system(ctx))
+      dir = opendir("/proc");
+    if (!dir)
+      error(ctx, "can not open directory '/proc'");
+  }
+
+  read_parent_status_and_mount_proc_file_system_if_necessary(ctx);
+
+  while ((de = readdir(dir)) != NULL) {
+    if (!is_positive_long(de->d_name, &pid))
+      continue;
+    if (pid <= 0)
+      continue;
+    if (pid == ctx->parent_pid)
+      continue;
+    if (read_process(ctx, pid))
+      res++;
+  }
+
+  (void)closedir(dir);
+  debug(ctx, "added", "%ld processes", res);
+
+  return res;
+}
+
+static long read_processes(runlim_ctx *ctx) {
+  if (ctx->single)
+    return read_process(ctx, ctx->child_pid);
+  else
+    return read_all_processes(ctx);
+}
+
+static void clear_tree_connections(Process *p) {
+  p->parent = p->first_child = p->last_child = p->next_sibbling = 0;
+}
+
+static void connect_process_tree(runlim_ctx *ctx) {
+  Process *p, *parent;
+  long connected = 0;
+
+  for (p = ctx->active_processes; p; p = p->next_process) {
+    assert(p->active);
+    assert(find_process(ctx, p->pid) == p);
+    parent = find_process(ctx, p->ppid);
+    clear_tree_connections(parent);
+    clear_tree_connections(p);
+  }
+
+  for (p = ctx->active_processes; p; p = p->next_process) {
+    if (p->pid == ctx->child_pid)
+      continue;
+    assert(p->pid != ctx->parent_pid);
+    parent = find_process(ctx, p->ppid);
+    p->parent = parent;
+    if (parent->first_child) {
+      assert(parent->last_child);
+      assert(!parent->last_child->next_sibbling);
+      parent->last_child->next_sibbling = p;
+      parent->last_child = p;
+      assert(!p->next_sibbling);
+    } else {
+      assert(!parent->last_child);
+      parent->first_child = parent->last_child = p;
+      assert(!p->next_sibbling);
+    }
+    debug(ctx, "connect", "%d -> %d", p->ppid, p->pid);
+    connected++;
+  }
+
+  debug(ctx, "connected", "%ld processes", connected);
+}
+
+/*------------------------------------------------------------------------*/
+
+static long flush_inactive_processes(runlim_ctx *ctx) {
+  Process *prev = 0;
+  Process *next;
+  long res = 0;
+  Process *p;
+
+  for (p = ctx->active_processes; p; p = next) {
+    assert(p->active);
+
+    next = p->next_process;
+
+    if (p->sampled == ctx->num_samples) {
+      prev = p;
+    } else {
+      p->active = 0;
+
+      if (prev)
+	prev->next_process = next;
+      else
+	ctx->active_processes = next;
+
+      accumulate_process(ctx, p);
+      debug(ctx, "deactive", "%d (%.3f sec)", p->pid, p->time);
+      p->next_process = 0;
+      res++;
+    }
+  }
+
+  ctx->last_active_process = prev;
+
+  debug(ctx, "flushed", "%ld processes", res);
+
+  return res;
+}
+
+/*------------------------------------------------------------------------*/
+
+/* With '--thread-states' the state of each thread of the sampled processes
+ * is read from '/proc/<pid>/task/<tid>/stat' at each sample.  Each thread
+ * sample accounts for the real time since the previous sample in the
+ * corresponding state (the sample rate can be changed through the control
+ * socket), which gives a cheap off-CPU profile.  For sleeping threads and
+ * threads in uninterruptible (disk) wait the kernel function they are
+ * blocked in is read from 'wchan' (or if that is not available the system
+ * call number from 'syscall') and the most frequent ones are reported.
+ */
+
+enum {
+  THREAD_RUNNING = 0,
+  THREAD_SLEEPING = 1,
+  THREAD_DISK = 2,
+  THREAD_STOPPED = 3,
+  THREAD_OTHER = 4
+};
+
+struct Blocker {
+  char name[64];
+  long count;
+};
+
+static int thread_state_index(char state) {
+  switch (state) {
+  case 'R':
+    return THREAD_RUNNING;
+  case 'S':
+    return THREAD_SLEEPING;
+  case 'D':
+    return THREAD_DISK;
+  case 'T':
+  case 't':
+    return THREAD_STOPPED;
+  default:
+    return THREAD_OTHER;
+  }
+}
+
+static void count_blocker(runlim_ctx *ctx, const char *name) {
+  size_t i;
+  for (i = 0; i < ctx->num_blockers; i++)
+    if (!strcmp(ctx->blockers[i].name, name)) {
+      ctx->blockers[i].count++;
+      return;
+    }
+  if (ctx->num_blockers == ctx->size_blockers) {
+    ctx->size_blockers = ctx->size_blockers ? 2 * ctx->size_blockers : 16;
+    ctx->blockers = realloc(ctx->blockers,
+			    ctx->size_blockers * sizeof *ctx->blockers);
+    if (!ctx->blockers)
+      error(ctx, "out-of-memory allocating blocking functions");
+  }
+  snprintf(ctx->blockers[ctx->num_blockers].name, sizeof ctx->blockers->name,
+	   "%s", name);
+  ctx->blockers[ctx->num_blockers++].count = 1;
+}
+
+static void read_blocker(runlim_ctx *ctx, long pid, long tid) {
+  char path[96], name[64];
+  FILE *file;
+  long nr;
+
+  name[0] = 0;
+
+  sprintf(path, "/proc/%ld/task/%ld/wchan", pid, tid);
+  file = fopen(path, "r");
+  if (file) {
+    if (!fgets(name, sizeof name, file))
+      name[0] = 0;
+    fclose(file);
+  }
+
+  if (!name[0] || !strcmp(name, "0")) {
+    strcpy(name, "unknown");
+    sprintf(path, "/proc/%ld/task/%ld/syscall", pid, tid);
+    file = fopen(path, "r");
+    if (file) {
+      if (fscanf(file, "%ld", &nr) == 1)
+	sprintf(name, "syscall %ld", nr);
+      fclose(file);
+    }
+  }
+
+  count_blocker(ctx, name);
+}
+
+static void sample_thread_states(runlim_ctx *ctx, long pid) {
+  char path[96], line[512], *p;
+  struct dirent *de;
+  int state;
+  FILE *file;
+  long tid;
+  DIR *dir;
+
+  sprintf(path, "/proc/%ld/task", pid);
+  dir = opendir(path);
+  if (!dir)
+    return;
+
+  while ((de = readdir(dir)) != NULL) {
+    if (!is_positive_long(de->d_name, &tid))
+      continue;
+    sprintf(path, "/proc/%ld/task/%ld/stat", pid, tid);
+    file = fopen(path, "r");
+    if (!file)
+      continue;
+    p = fgets(line, sizeof line, file) ? strrchr(line, ')') : 0;
+    fclose(file);
+    if (!p || p[1] != ' ')
+      continue;
+    state = thread_state_index(p[2]);
+    ctx->thread_state_seconds[state] += ctx->thread_state_period;
+    if (state == THREAD_SLEEPING || state == THREAD_DISK)
+      read_blocker(ctx, pid, tid);
+  }
+
+  (void)closedir(dir);
+}
+
+static void reset_thread_states(runlim_ctx *ctx) {
+  memset(ctx->thread_state_seconds, 0, sizeof ctx->thread_state_seconds);
+  ctx->thread_state_period = ctx->last_thread_state_sample = 0;
+  ctx->num_blockers = 0;
+}
+
+static int cmp_blockers(const void *p, const void *q) {
+  const Blocker *a = p, *b = q;
+  if (a->count != b->count)
+    return a->count < b->count ? 1 : -1;
+  return strcmp(a->name, b->name);
+}
+
+static void report_thread_states(runlim_ctx *ctx) {
+  long blocked = 0;
+  char name[32];
+  size_t i;
+
+  message(ctx, "thread states",
+	  "%.2f running, %.2f sleeping, %.2f disk, %.2f stopped seconds",
+	  ctx->thread_state_seconds[THREAD_RUNNING],
+	  ctx->thread_state_seconds[THREAD_SLEEPING],
+	  ctx->thread_state_seconds[THREAD_DISK],
+	  ctx->thread_state_seconds[THREAD_STOPPED]);
+
+  for (i = 0; i < ctx->num_blockers; i++)
+    blocked += ctx->blockers[i].count;
+
+  qsort(ctx->blockers, ctx->num_blockers, sizeof *ctx->blockers, cmp_blockers);
+  for (i = 0; i < ctx->num_blockers && i < THREAD_BLOCKERS; i++) {
+    sprintf(name, "blocked[%zu]", i + 1);
+    message(ctx, name, "%.0f%% %s", 100.0 * ctx->blockers[i].count / blocked,
+	    ctx->blockers[i].name);
+  }
+}
+
+/*------------------------------------------------------------------------*/
+
+/* With '--profile=<file>' the program is profiled with a sampling software
+ * CPU clock event ('perf_event_open') on each CPU, which is inherited by
+ * all its descendants and only enabled when the child executes the
+ * program.  Samples include the user space call chain.  The ring buffers
+ * are drained while sampling and identical call chains are counted in a
+ * hash table.  The executable mappings of each sampled process are read
+ * from '/proc/<pid>/maps' when it is first seen (or when it executed
+ * another program).  After the run the addresses are symbolized with the
+ * ELF symbol tables of the mapped files and the stacks are written in the
+ * folded format expected by flame graph tools, one line per stack of
+ * the form 'command;root;...;leaf count'.  If the event can not be opened
+ * profiling falls back to '--thread-states'.
+ */
+
+typedef struct Mapping Mapping;
+typedef struct Symbol Symbol;
+
+struct Mapping {
+  uint64_t start, end, offset;
+  char *path;
+};
+
+struct Profiled {
+  int pid;
+  char comm[16];
+  Mapping *mappings;
+  size_t num_mappings;
+};
+
+struct Stack {
+  Stack *next;
+  int pid;
+  long count;
+  uint64_t nr;
+  uint64_t ips[];
+};
+
+struct Symbol {
+  uint64_t start, end;
+  char *name;
+};
+
+struct Symbols {
+  Symbols *next;
+  char *path;
+  Symbol *symbols;
+  size_t count;
+  Elf64_Phdr *segments;
+  size_t num_segments;
+};
+
+static uint64_t hash_stack(int pid, uint64_t nr, const uint64_t *ips) {
+  uint64_t res = 0xcbf29ce484222325ull ^ (unsigned)pid;
+  uint64_t i;
+  for (i = 0; i < nr; i++)
+    res = (res ^ ips[i]) * 0x100000001b3ull;
+  return res;
+}
+
+static void count_stack(runlim_ctx *ctx, int pid, uint64_t nr,
+			const uint64_t *ips) {
+  const uint64_t h = hash_stack(pid, nr, ips) & (PROFILE_STACKS - 1);
+  Stack *s;
+
+  for (s = ctx->stacks[h]; s; s = s->next)
+    if (s->pid == pid && s->nr == nr &&
+	!memcmp(s->ips, ips, nr * sizeof *ips)) {
+      s->count++;
+      return;
+    }
+
+  s = malloc(sizeof *s + nr * sizeof *ips);
+  if (!s)
+    error(ctx, "out-of-memory allocating profile stack");
+  s->pid = pid;
+  s->count = 1;
+  s->nr = nr;
+  memcpy(s->ips, ips, nr * sizeof *ips);
+  s->next = ctx->stacks[h];
+  ctx->stacks[h] = s;
+}
+
+static Profiled *find_profiled(runlim_ctx *ctx, int pid) {
+  Profiled *p;
+  for (p = ctx->profiled + ctx->num_profiled; p-- > ctx->profiled;)
+    if (p->pid == pid)
+      return p;
+  if (ctx->num_profiled == ctx->size_profiled) {
+    ctx->size_profiled = ctx->size_profiled ? 2 * ctx->size_profiled : 16;
+    ctx->profiled = realloc(ctx->profiled,
+			    ctx->size_profiled * sizeof *ctx->profiled);
+    if (!ctx->profiled)
+      error(ctx, "out-of-memory allocating profiled processes");
+  }
+  p = ctx->profiled + ctx->num_profiled++;
+  memset(p, 0, sizeof *p);
+  p->pid = pid;
+  strcpy(p->comm, "unknown");
+  return p;
+}
+
+static void release_mappings(Profiled *p) {
+  size_t i;
+  for (i = 0; i < p->num_mappings; i++)
+    free(p->mappings[i].path);
+  free(p->mappings);
+  p->mappings = 0;
+  p->num_mappings = 0;
+}
+
+static void read_mappings(runlim_ctx *ctx, Profiled *p) {
+  char path[64], line[PATH_MAX + 128], perms[8], file_name[PATH_MAX];
+  unsigned long long start, end, offset;
+  size_t size = 0;
+  Mapping *m;
+  FILE *file;
+
+  sprintf(path, "/proc/%d/maps", p->pid);
+  file = fopen(path, "r");
+  if (!file)
+    return;
+
+  release_mappings(p);
+
+  while (fgets(line, sizeof line, file)) {
+    if (sscanf(line, "%llx-%llx %7s %llx %*s %*s %4095s", &start, &end, perms,
+	       &offset, file_name) != 5)
+      continue;
+    if (!strchr(perms, 'x') || file_name[0] != '/')
+      continue;
+    if (p->num_mappings == size) {
+      size = size ? 2 * size : 16;
+      p->mappings = realloc(p->mappings, size * sizeof *p->mappings);
+      if (!p->mappings)
+	error(ctx, "out-of-memory allocating mappings");
+    }
+    m = p->mappings + p->num_mappings++;
+    m->start = start;
+    m->end = end;
+    m->offset = offset;
+    m->path = strdup(file_name);
+    if (!m->path)
+      error(ctx, "out-of-memory allocating mapping");
+  }
+  fclose(file);
+
+  sprintf(path, "/proc/%d/comm", p->pid);
+  file = fopen(path, "r");
+  if (file) {
+    if (fscanf(file, "%15[^\n]", p->comm) != 1)
+      strcpy(p->comm, "unknown");
+    fclose(file);
+  }
+}
+
+static Mapping *find_mapping(Profiled *p, uint64_t ip) {
+  size_t i;
+  for (i = 0; i < p->num_mappings; i++)
+    if (p->mappings[i].start <= ip && ip < p->mappings[i].end)
+      return p->mappings + i;
+  return 0;
+}
+
+static void process_sample(runlim_ctx *ctx, const uint32_t *tid,
+			   const uint64_t *callchain) {
+  uint64_t nr = callchain[0], i, n = 0;
+  const uint64_t *ips = callchain + 1;
+  uint64_t user[PROFILE_DEPTH];
+  int unmapped = 0;
+  Profiled *p;
+
+  for (i = 0; i < nr && n < PROFILE_DEPTH; i++)
+    if (ips[i] < (uint64_t)PERF_CONTEXT_MAX)
+      user[n++] = ips[i];
+
+  if (!n)
+    return;
+
+  p = find_profiled(ctx, tid[0]);
+  for (i = 0; i < n && !unmapped; i++)
+    unmapped = !find_mapping(p, user[i]);
+  if (unmapped)
+    read_mappings(ctx, p);
+
+  count_stack(ctx, tid[0], n, user);
+  ctx->profile_samples++;
+}
+
+static void drain_profile_buffer(runlim_ctx *ctx, void *buffer) {
+  struct perf_event_mmap_page *page = buffer;
+  const uint64_t size = PROFILE_PAGES * ctx->page_size;
+  char *data = (char *)buffer + ctx->page_size;
+  uint64_t head, tail, offset;
+  struct perf_event_header *header;
+  uint64_t record[(1 << 16) / sizeof(uint64_t)];
+  size_t first;
+
+  head = __atomic_load_n(&page->data_head, __ATOMIC_ACQUIRE);
+  tail = page->data_tail;
+
+  while (tail < head) {
+    offset = tail % size;
+    header = (struct perf_event_header *)(data + offset);
+    if (offset + header->size > size) {
+      first = size - offset;
+      memcpy(record, data + offset, first);
+      memcpy((char *)record + first, data, header->size - first);
+      header = (struct perf_event_header *)record;
+    }
+    if (!header->size)
+      break;
+    if (header->type == PERF_RECORD_SAMPLE)
+      process_sample(ctx, (uint32_t *)(header + 1),
+		     (uint64_t *)((uint32_t *)(header + 1) + 2));
+    else if (header->type == PERF_RECORD_LOST)
+      ctx->profile_lost += ((uint64_t *)(header + 1))[1];
+    tail += header->size;
+  }
+
+  __atomic_store_n(&page->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+static void drain_profile(runlim_ctx *ctx) {
+  int i;
+  for (i = 0; i < ctx->num_profile_events; i++)
+    drain_profile_buffer(ctx, ctx->profile_buffers[i]);
+}
+
+static void start_profile(runlim_ctx *ctx) {
+  struct perf_event_attr attr;
+  int cpus, cpu, fd;
+  void *buffer;
+
+  cpus = sysconf(_SC_NPROCESSORS_CONF);
+  if (cpus <= 0)
+    cpus = 1;
+
+  ctx->profile_fds = malloc(cpus * sizeof *ctx->profile_fds);
+  ctx->profile_buffers = malloc(cpus * sizeof *ctx->profile_buffers);
+  ctx->stacks = calloc(PROFILE_STACKS, sizeof *ctx->stacks);
+  if (!ctx->profile_fds || !ctx->profile_buffers || !ctx->stacks)
+    error(ctx, "out-of-memory allocating profile");
+
+  memset(&attr, 0, sizeof attr);
+  attr.size = sizeof attr;
+  attr.type = PERF_TYPE_SOFTWARE;
+  attr.config = PERF_COUNT_SW_CPU_CLOCK;
+  attr.freq = 1;
+  attr.sample_freq = PROFILE_FREQUENCY;
+  attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN;
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.enable_on_exec = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.exclude_callchain_kernel = 1;
+
+  ctx->num_profile_events = 0;
+  for (cpu = 0; cpu < cpus; cpu++) {
+    fd = syscall(SYS_perf_event_open, &attr, ctx->child_pid, cpu, -1,
+		 PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0)
+      continue;
+    buffer = mmap(0, (PROFILE_PAGES + 1) * ctx->page_size,
+		  PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (buffer == MAP_FAILED) {
+      (void)close(fd);
+      continue;
+    }
+    ctx->profile_fds[ctx->num_profile_events] = fd;
+    ctx->profile_buffers[ctx->num_profile_events++] = buffer;
+  }
+
+  if (ctx->num_profile_events)
+    return;
+
+  warning(ctx, "can not open profiling event (%s)%s", strerror(errno),
+	  ctx->thread_states ? "" : " thus sampling thread states instead");
+  ctx->thread_states = 1;
+}
+
+static int cmp_symbols(const void *p, const void *q) {
+  const Symbol *a = p, *b = q;
+  if (a->start != b->start)
+    return a->start < b->start ? -1 : 1;
+  return 0;
+}
+
+static void read_elf_symbols(runlim_ctx *ctx, Symbols *s, const char *image,
+			     size_t size) {
+  const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)image;
+  const Elf64_Shdr *shdr, *strtab;
+  const Elf64_Sym *sym, *end;
+  size_t i, size_symbols = 0;
+  Symbol *symbol;
+
+  if (size < sizeof *ehdr || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+      ehdr->e_ident[EI_CLASS] != ELFCLASS64)
+    return;
+
+  if (ehdr->e_phoff + ehdr->e_phnum * sizeof(Elf64_Phdr) <= size) {
+    s->segments = malloc(ehdr->e_phnum * sizeof *s->segments);
+    if (!s->segments)
+      error(ctx, "out-of-memory allocating ELF segments");
+    for (i = 0; i < ehdr->e_phnum; i++) {
+      const Elf64_Phdr *phdr =
+	  (const Elf64_Phdr *)(image + ehdr->e_phoff) + i;
+      if (phdr->p_type == PT_LOAD)
+	s->segments[s->num_segments++] = *phdr;
+    }
+  }
+
+  if (ehdr->e_shoff + ehdr->e_shnum * sizeof *shdr > size)
+    return;
+  shdr = (const Elf64_Shdr *)(image + ehdr->e_shoff);
+
+  for (i = 0; i < ehdr->e_shnum; i++) {
+    if (shdr[i].sh_type != SHT_SYMTAB && shdr[i].sh_type != SHT_DYNSYM)
+      continue;
+    if (shdr[i].sh_link >= ehdr->e_shnum ||
+	shdr[i].sh_offset + shdr[i].sh_size > size)
+      continue;
+    strtab = shdr + shdr[i].sh_link;
+    if (strtab->sh_offset + strtab->sh_size > size)
+      continue;
+    sym = (const Elf64_Sym *)(image + shdr[i].sh_offset);
+    end = sym + shdr[i].sh_size / sizeof *sym;
+    for (; sym < end; sym++) {
+      if (ELF64_ST_TYPE(sym->st_info) != STT_FUNC || !sym->st_value)
+	continue;
+      if (sym->st_name >= strtab->sh_size)
+	continue;
+      if (s->count == size_symbols) {
+	size_symbols = size_symbols ? 2 * size_symbols : 256;
+	s->symbols = realloc(s->symbols, size_symbols * sizeof *s->symbols);
+	if (!s->symbols)
+	  error(ctx, "out-of-memory allocating ELF symbols");
+      }
+      symbol = s->symbols + s->count++;
+      symbol->start = sym->st_value;
+      symbol->end = sym->st_value + (sym->st_size ? sym->st_size : 1);
+      symbol->name = strdup(image + strtab->sh_offset + sym->st_name);
+      if (!symbol->name)
+	error(ctx, "out-of-memory allocating ELF symbol");
+    }
+  }
+
+  qsort(s->symbols, s->count, sizeof *s->symbols, cmp_symbols);
+}
+
+static Symbols *load_symbols(runlim_ctx *ctx, const char *path) {
+  struct stat buf;
+  void *image;
+  Symbols *s;
+  int fd;
+
+  for (s = ctx->symbols; s; s = s->next)
+    if (!strcmp(s->path, path))
+      return s;
+
+  s = calloc(1, sizeof *s);
+  if (!s || !(s->path = strdup(path)))
+    error(ctx, "out-of-memory allocating ELF symbols");
+  s->next = ctx->symbols;
+  ctx->symbols = s;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return s;
+  if (!fstat(fd, &buf) && buf.st_size > 0) {
+    image = mmap(0, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (image != MAP_FAILED) {
+      read_elf_symbols(ctx, s, image, buf.st_size);
+      (void)munmap(image, buf.st_size);
+    }
+  }
+  (void)close(fd);
+
+  debug(ctx, "profile", "%zu symbols in '%s'", s->count, path);
+
+  return s;
+}
+
+static const char *symbolize(runlim_ctx *ctx, Profiled *p, uint64_t ip) {
+  uint64_t offset, address;
+  size_t lo, hi, mid, i;
+  const char *base;
+  Mapping *m;
+  Symbols *s;
+
+  m = find_mapping(p, ip);
+  if (!m)
+    return "[unknown]";
+
+  s = load_symbols(ctx, m->path);
+  offset = ip - m->start + m->offset;
+  address = offset;
+  for (i = 0; i < s->num_segments; i++)
+    if (s->segments[i].p_offset <= offset &&
+	offset < s->segments[i].p_offset + s->segments[i].p_filesz) {
+      address = offset - s->segments[i].p_offset + s->segments[i].p_vaddr;
+      break;
+    }
+
+  lo = 0, hi = s->count;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (s->symbols[mid].start <= address)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo && address < s->symbols[lo - 1].end)
+    return s->symbols[lo - 1].name;
+
+  base = strrchr(m->path, '/');
+  return base ? base + 1 : m->path;
+}
+
+static void write_folded_name(FILE *file, const char *name) {
+  for (; *name; name++)
+    fputc(*name == ';' || isspace((unsigned char)*name) ? '_' : *name, file);
+}
+
+typedef struct Folded Folded;
+
+struct Folded {
+  char *line;
+  long count;
+};
+
+static int cmp_folded(const void *p, const void *q) {
+  return strcmp(((const Folded *)p)->line, ((const Folded *)q)->line);
+}
+
+// Different call chains might be symbolized to the same folded stack,
+// thus these are sorted and merged before writing them.
+
+static void write_profile(runlim_ctx *ctx) {
+  size_t num_folded = 0, size_folded = 0, h, i, j, len;
+  Folded *folded = 0;
+  FILE *file, *line;
+  Profiled *p;
+  uint64_t k;
+  Stack *s;
+  long count;
+
+  for (h = 0; h < PROFILE_STACKS; h++)
+    for (s = ctx->stacks[h]; s; s = s->next) {
+      if (num_folded == size_folded) {
+	size_folded = size_folded ? 2 * size_folded : 256;
+	folded = realloc(folded, size_folded * sizeof *folded);
+	if (!folded)
+	  error(ctx, "out-of-memory allocating folded stacks");
+      }
+      line = open_memstream(&folded[num_folded].line, &len);
+      if (!line)
+	error(ctx, "out-of-memory allocating folded stack");
+      p = find_profiled(ctx, s->pid);
+      write_folded_name(line, p->comm);
+      for (k = s->nr; k-- > 0;) {
+	fputc(';', line);
+	write_folded_name(line, symbolize(ctx, p, s->ips[k]));
+      }
+      fclose(line);
+      folded[num_folded++].count = s->count;
+    }
+
+  qsort(folded, num_folded, sizeof *folded, cmp_folded);
+
+  file = fopen(ctx->profile_path, "w");
+  if (!file)
+    warning(ctx, "can not write profile '%s'", ctx->profile_path);
+
+  for (i = 0; i < num_folded; i = j) {
+    count = 0;
+    for (j = i; j < num_folded && !strcmp(folded[i].line, folded[j].line);
+	 j++)
+      count += folded[j].count;
+    if (file)
+      fprintf(file, "%s %ld\n", folded[i].line, count);
+  }
+
+  if (file)
+    fclose(file);
+
+  for (i = 0; i < num_folded; i++)
+    free(folded[i].line);
+  free(folded);
+}
+
+static void release_profile(runlim_ctx *ctx) {
+  Symbols *s, *next_symbols;
+  Stack *stack, *next;
+  size_t h, i;
+  int j;
+
+  for (j = 0; j < ctx->num_profile_events; j++) {
+    (void)munmap(ctx->profile_buffers[j], (PROFILE_PAGES + 1) * ctx->page_size);
+    (void)close(ctx->profile_fds[j]);
+  }
+  ctx->num_profile_events = 0;
+  free(ctx->profile_buffers);
+  free(ctx->profile_fds);
+  ctx->profile_buffers = 0;
+  ctx->profile_fds = 0;
+
+  if (ctx->stacks)
+    for (h = 0; h < PROFILE_STACKS; h++)
+      for (stack = ctx->stacks[h]; stack; stack = next) {
+	next = stack->next;
+	free(stack);
+      }
+  free(ctx->stacks);
+  ctx->stacks = 0;
+
+  for (i = 0; i < ctx->num_profiled; i++)
+    release_mappings(ctx->profiled + i);
+  free(ctx->profiled);
+  ctx->profiled = 0;
+  ctx->num_profiled = ctx->size_profiled = 0;
+
+  for (s = ctx->symbols; s; s = next_symbols) {
+    next_symbols = s->next;
+    for (i = 0; i < s->count; i++)
+      free(s->symbols[i].name);
+    free(s->symbols);
+    free(s->segments);
+    free(s->path);
+    free(s);
+  }
+  ctx->symbols = 0;
+
+  ctx->profile_samples = ctx->profile_lost = 0;
+}
+
+static void stop_profile(runlim_ctx *ctx) {
+  if (ctx->num_profile_events) {
+    drain_profile(ctx);
+    write_profile(ctx);
+    message(ctx, "profile", "%ld samples (%ld lost) in '%s'",
+	    ctx->profile_samples, ctx->profile_lost, ctx->profile_path);
+  }
+  release_profile(ctx);
+}
+
+/*------------------------------------------------------------------------*/
+
+static long sample_recursively(runlim_ctx *ctx, Process *p) {
+  const char *type;
+  Process *child;
+  long res = 0;
+
+  if (p->cyclic_sampling) {
+    warning(ctx, "cyclic process dependencies during sampling");
+    return 0;
+  }
+
+  if (p->sampled == ctx->num_samples) {
+    if (p->new) {
+      ctx->children++;
+      type = "sampling (new)";
+    } else
+      type = "sampling";
+
+    ctx->sampled_time += p->time;
+    ctx->sampled_memory += p->memory;
+    ctx->sampled_wait += p->wait;
+    ctx->sampled_voluntary += p->voluntary;
+    ctx->sampled_involuntary += p->involuntary;
+    ctx->sampled_processes++;
+    ctx->sampled_threads += p->threads;
+    ctx->sampled_minor_faults += p->minor_faults;
+    ctx->sampled_major_faults += p->major_faults;
+    ctx->sampled_swap += p->swap;
+    ctx->sampled_huge += p->huge;
+    add_io(&ctx->sampled_io, &p->io);
+
+    if (ctx->cpu_frequency)
+      mark_processor(ctx, p->processor);
+
+    p->counted = 1;
+
+    if (ctx->thread_states)
+      sample_thread_states(ctx, p->pid);
+
+    res++;
+    debug(ctx, type, "%d (%.3f sec, %.3f MB)", p->pid, p->time, p->memory);
+  }
+
+  p->cyclic_sampling = 1;
+
+  for (child = p->first_child; child; child = child->next_sibbling)
+    res += sample_recursively(ctx, child);
+
+  assert(p->cyclic_sampling);
+  p->cyclic_sampling = 0;
+
+  return res;
+}
+
+/*------------------------------------------------------------------------*/
+
+/* Before signalling a process we check that its start time did not
+ * change, i.e., that its process identifier was not reused in the mean
+ * time.  With 'pidfd_open' the process is pinned before the check and then
+ * signalled through the file descriptor, which avoids signalling another
+ * process started between the check and 'kill'.
+ */
+
+static unsigned long long read_start_time(int pid) {
+  unsigned long long res;
+  char path[64], line[1024];
+  const char *p;
+  size_t bytes;
+  FILE *file;
+
+  sprintf(path, "/proc/%d/stat", pid);
+  file = fopen(path, "r");
+  if (!file)
+    return 0;
+  bytes = fread(line, 1, sizeof line - 1, file);
+  fclose(file);
+  line[bytes] = 0;
+
+  p = strrchr(line, ')');
+  if (!p || sscanf(p + 1,
+		   " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u"
+		   " %*d %*d %*d %*d %*d %*d %llu",
+		   &res) != 1)
+    return 0;
+
+  return res;
+}
+
+static void signal_process(runlim_ctx *ctx, Process *p, int sig) {
+  int fd = -1;
+
+  assert(p->pid != ctx->parent_pid);
+
+#if defined(SYS_pidfd_open) && defined(SYS_pidfd_send_signal)
+  fd = syscall(SYS_pidfd_open, p->pid, 0);
+  if (fd < 0 && errno == ESRCH)
+    return;
+#endif
+
+  if (read_start_time(p->pid) != p->start)
+    debug(ctx, "stale", "%d not signalled (reused)", p->pid);
+#if defined(SYS_pidfd_open) && defined(SYS_pidfd_send_signal)
+  else if (fd >= 0)
+    (void)syscall(SYS_pidfd_send_signal, fd, sig, 0, 0);
+#endif
+  else
+    kill(p->pid, sig);
+
+  if (fd >= 0)
+    (void)close(fd);
+}
+
+static void term_process(runlim_ctx *ctx, Process *p) {
+  assert(p->pid != ctx->parent_pid);
+  debug(ctx, "kill with SIGTERM ", "%d", p->pid);
+  signal_process(ctx, p, SIGTERM);
+}
+
+static void kill_process(runlim_ctx *ctx, Process *p) {
+  assert(p->pid != ctx->parent_pid);
+  debug(ctx, "kill with SIGKILL ", "%d", p->pid);
+  signal_process(ctx, p, SIGKILL);
+}
+
+typedef void (*Killer)(runlim_ctx *, Process *);
+
+static long kill_recursively(runlim_ctx *ctx, Process *p, Killer killer) {
+  Process *child;
+  long res = 0;
+
+  if (p->cyclic_killing)
+    return 0;
+
+  p->cyclic_killing = 1;
+  for (child = p->first_child; child; child = child->next_sibbling)
+    res += kill_recursively(ctx, child, killer);
+  assert(p->cyclic_killing);
+  p->cyclic_killing = 0;
+
+  killer(ctx, p);
+  res++;
+
+  return res;
+}
+
+static int ancestor_in_same_session(runlim_ctx *ctx, Process *p) {
+  if (p->psession != ctx->session_pid)
+    return 0;
+  if (!ctx->single) {
+    assert(ctx->session_pid <= ctx->child_pid);
+    if (ctx->session_pid <= p->pid && p->pid < ctx->child_pid)
+      return 1;
+  }
+  return 0;
+}
+
+static int ancestor_in_same_group(runlim_ctx *ctx, Process *p) {
+  if (p->pgrp != ctx->group_pid)
+    return 0;
+  if (!ctx->single) {
+    assert(ctx->group_pid <= ctx->child_pid);
+    if (ctx->group_pid <= p->pid && p->pid < ctx->child_pid)
+      return 1;
+  }
+  return 0;
+}
+
+static int is_root_zombie(runlim_ctx *ctx, Process *p) {
+  if (p->pid == ctx->child_pid)
+    return 0;
+  if (p->ppid == ctx->child_pid)
+    return 0;
+  if (ancestor_in_same_group(ctx, p))
+    return 0;
+  if (ancestor_in_same_session(ctx, p))
+    return 0;
+  Process *parent = find_process(ctx, p->ppid);
+  return parent->pgrp != ctx->group_pid && parent->psession != ctx->session_pid;
+}
+
+static long signal_all_child_processes(runlim_ctx *ctx, Killer killer) {
+  long res = 0;
+  Process *p;
+
+  if (read_processes(ctx) > 0) {
+    connect_process_tree(ctx);
+    p = find_process(ctx, ctx->child_pid);
+    if (p->active)
+      res = kill_recursively(ctx, p, killer);
+
+    for (p = ctx->active_processes; p; p = p->next_process)
+      if (p->active && is_root_zombie(ctx, p))
+	res += kill_recursively(ctx, p, killer);
+  }
+
+  return res;
+}
+
+static void kill_all_child_processes(runlim_ctx *ctx) {
+  Killer killer;
+  long ms = ctx->kill_delay * 1000;
+  long rounds = 0;
+  long killed;
+  int ignore;
+
+  assert(getpid() == ctx->parent_pid);
+
+  pthread_mutex_lock(&ctx->killing_mutex);
+  if (!(ignore = ctx->killing))
+    ctx->killing = 1;
+  pthread_mutex_unlock(&ctx->killing_mutex);
+  if (ignore)
+    return;
+
+  debug(ctx, "killing", "all child processes");
+
+  for (;;) {
+    if (ms >= 2000)
+      killer = term_process;
+    else
+      killer = kill_process;
+
+    killed = signal_all_child_processes(ctx, killer);
+
+    debug(ctx, "killed", "%ld processes", killed);
+
+    if (!killed)
+      break;
+    if (ms <= 1000)
+      break;
+
+    rounds++;
+
+    usleep(ms);
+    ms /= 2;
+  }
+}
+
+/*------------------------------------------------------------------------*/
+
+static double wall_clock_time(void) {
+  double res = -1;
+  struct timeval tv;
+  if (!gettimeofday(&tv, 0)) {
+    res = 1e-6 * tv.tv_usec;
+    res += tv.tv_sec;
+  }
+  return res;
+}
+
+static double tai_time(void) {
+  double res = -1;
+  struct timespec ts;
+  if (!clock_gettime(CLOCK_TAI, &ts)) {
+    res = 1e-9 * ts.tv_nsec;
+    res += ts.tv_sec;
+  }
+  return res;
+}
+
+/*------------------------------------------------------------------------*/
+
+/* Freezing a job suspends all its processes without them noticing,
+ * either through the cgroup freezer or otherwise by sending 'SIGSTOP' to
+ * all processes in the process tree.  Sampling is suspended while the
+ * job is frozen and the frozen time is excluded from the real time.
+ */
+
+static void stop_process(runlim_ctx *ctx, Process *p) {
+  assert(p->pid != ctx->parent_pid);
+  debug(ctx, "stop with SIGSTOP", "%d", p->pid);
+  signal_process(ctx, p, SIGSTOP);
+}
+
+static void continue_process(runlim_ctx *ctx, Process *p) {
+  assert(p->pid != ctx->parent_pid);
+  debug(ctx, "continue with SIGCONT", "%d", p->pid);
+  signal_process(ctx, p, SIGCONT);
+}
+
+static int freeze_child_processes(runlim_ctx *ctx) {
+  long stopped;
+
+  if (ctx->frozen)
+    return 0;
+
+  if (ctx->cgroup_path && write_cgroup_file(ctx, "cgroup.freeze", "1\n"))
+    debug(ctx, "freeze", "cgroup '%s'", ctx->cgroup_path);
+  else {
+    stopped = signal_all_child_processes(ctx, stop_process);
+    debug(ctx, "freeze", "stopped %ld processes", stopped);
+  }
+
+  ctx->frozen_since = tai_time();
+  ctx->frozen = 1;
+  ctx->freezes++;
+
+  return 1;
+}
+
+static int thaw_child_processes(runlim_ctx *ctx) {
+  long continued;
+
+  if (!ctx->frozen)
+    return 0;
+
+  if (ctx->cgroup_path && write_cgroup_file(ctx, "cgroup.freeze", "0\n"))
+    debug(ctx, "thaw", "cgroup '%s'", ctx->cgroup_path);
+  else {
+    continued = signal_all_child_processes(ctx, continue_process);
+    debug(ctx, "thaw", "continued %ld processes", continued);
+  }
+
+  ctx->frozen_time += tai_time() - ctx->frozen_since;
+  ctx->frozen = 0;
+
+  return 1;
+}
+
+static void thaw_all_child_processes(runlim_ctx *ctx) {
+  (void)thaw_child_processes(ctx);
+}
+
+/* Thawing and killing read the process table.  Sampling and control
+ * commands do so while holding the sampler mutex.  The supervising thread
+ * thus takes it too before it thaws or kills the job, since the control
+ * thread might still execute commands concurrently.  An error releases
+ * the mutex before it is passed on.
+ */
+
+static void run_under_sampler_mutex(runlim_ctx *ctx,
+				    void (*action)(runlim_ctx *)) {
+  sigjmp_buf *previous = recovery;
+  sigjmp_buf recover;
+
+  pthread_mutex_lock(&ctx->sampler_mutex);
+  if (sigsetjmp(recover, 0)) {
+    recovery = previous;
+    pthread_mutex_unlock(&ctx->sampler_mutex);
+    if (recovery)
+      siglongjmp(*recovery, 1);
+    abort();
+  }
+  recovery = &recover;
+  action(ctx);
+  recovery = previous;
+  pthread_mutex_unlock(&ctx->sampler_mutex);
+}
+
+/*------------------------------------------------------------------------*/
+
+static double real_time(runlim_ctx *ctx) {
+  double now, res;
+  if (ctx->start_time_tai < 0)
+    return -1;
+  now = tai_time();
+  res = now - ctx->start_time_tai - ctx->frozen_time;
+  if (ctx->frozen)
+    res -= now - ctx->frozen_since;
+  return res;
+}
+
+/*------------------------------------------------------------------------*/
+
+static void report(runlim_ctx *ctx, double time, double memory, double load) {
+  double real = real_time(ctx);
+  message(ctx, "sample", "%.2f time, %.2f real, %.0f MB, %.2f load", time, real,
+	  memory, load);
+  ctx->num_reports++;
+}
+
+/*------------------------------------------------------------------------*/
+
+static void print_process_tree(runlim_ctx *ctx, Process *p) {
+  Process *c;
+  debug(ctx, "edge", "%d -> %d", p->ppid, p->pid);
+  for (c = p->first_child; c; c = c->next_sibbling)
+    print_process_tree(ctx, c);
+}
+
+/*------------------------------------------------------------------------*/
+
+static double sample_load(runlim_ctx *ctx) {
+  double load;
+  int res = getloadavg(&load, 1);
+  if (res != 1)
+    return 0;
+  if (load > ctx->max_load)
+    ctx->max_load = load;
+  return load;
+}
+
+/*------------------------------------------------------------------------*/
+
+static void open_status_page(runlim_ctx *ctx, const char *program) {
+  const char *type = "status page";
+  size_t len;
+  int fd;
+
+  assert(ctx->status_page_dir);
+  assert(!ctx->status_page);
+
+  len = strlen(ctx->status_page_dir) + 32;
+  ctx->status_page_path = malloc(len);
+  if (!ctx->status_page_path)
+    error(ctx, "out-of-memory allocating status page path");
+  snprintf(ctx->status_page_path, len, "%s/runlim.%ld", ctx->status_page_dir,
+	   ctx->supervisor);
+
+  // The path is predictable, thus never follow a planted symbolic link
+  // nor write into a file somebody else created.  A stale page of an
+  // earlier run with the same process id is removed and created again.
+
+  fd = open(ctx->status_page_path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW,
+	    0644);
+  if (fd < 0 && errno == EEXIST && !unlink(ctx->status_page_path))
+    fd = open(ctx->status_page_path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW,
+	      0644);
+  if (fd < 0) {
+    warning(ctx, "can not create status page '%s'", ctx->status_page_path);
+    return;
+  }
+
+  if (ftruncate(fd, sizeof *ctx->status_page)) {
+    warning(ctx, "can not resize status page '%s'", ctx->status_page_path);
+    (void)close(fd);
+    (void)unlink(ctx->status_page_path);
+    return;
+  }
+
+  ctx->status_page = mmap(0, sizeof *ctx->status_page, PROT_READ | PROT_WRITE,
+		     MAP_SHARED, fd, 0);
+  (void)close(fd);
+
+  if (ctx->status_page == MAP_FAILED) {
+    warning(ctx, "can not map status page '%s'", ctx->status_page_path);
+    (void)unlink(ctx->status_page_path);
+    ctx->status_page = 0;
+    return;
+  }
+
+  ctx->status_page->magic = STATUS_PAGE_MAGIC;
+  ctx->status_page->version = STATUS_PAGE_VERSION;
+  ctx->status_page->pid = ctx->parent_pid;
+  ctx->status_page->child = ctx->child_pid;
+  ctx->status_page->state = RUNNING;
+  ctx->status_page->start = ctx->start_time;
+  ctx->status_page->updated = ctx->start_time;
+  ctx->status_page->time_limit = ctx->time_limit;
+  ctx->status_page->real_time_limit = ctx->real_time_limit;
+  ctx->status_page->space_limit = ctx->space_limit;
+  strncpy(ctx->status_page->program, program,
+	  sizeof ctx->status_page->program - 1);
+
+  debug(ctx, type, "%s", ctx->status_page_path);
+}
+
+static void update_status_page(runlim_ctx *ctx, State state, long sampled,
+			       double load) {
+  uint32_t sequence;
+
+  if (!ctx->status_page)
+    return;
+
+  sequence = ctx->status_page->sequence;
+  __atomic_store_n(&ctx->status_page->sequence, sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  ctx->status_page->state = state;
+  ctx->status_page->processes = sampled;
+  ctx->status_page->samples = ctx->num_samples;
+  ctx->status_page->updated = wall_clock_time();
+  ctx->status_page->time = ctx->sampled_time;
+  ctx->status_page->real = real_time(ctx);
+  ctx->status_page->memory = ctx->sampled_memory;
+  ctx->status_page->load = load;
+  ctx->status_page->time_limit = ctx->time_limit;
+  ctx->status_page->real_time_limit = ctx->real_time_limit;
+  ctx->status_page->space_limit = ctx->space_limit;
+
+  __atomic_store_n(&ctx->status_page->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+static void close_status_page(runlim_ctx *ctx) {
+  if (ctx->status_page) {
+    (void)munmap(ctx->status_page, sizeof *ctx->status_page);
+    (void)unlink(ctx->status_page_path);
+    ctx->status_page = 0;
+  }
+  if (ctx->status_page_path) {
+    free(ctx->status_page_path);
+    ctx->status_page_path = 0;
+  }
+}
+
+/*------------------------------------------------------------------------*/
+
+/* Copy a consistent snapshot of a status page, which requires the sequence
+ * number to be even and to stay the same while copying.  We give up after
+ * a bounded number of attempts, since the writer might have died while
+ * updating the page.
+ */
+
+static int read_status_page(const StatusPage *page, StatusPage *copy) {
+  uint32_t before, after;
+  int attempts;
+
+  for (attempts = 0; attempts < 1000; attempts++) {
+    before = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE);
+    if (before & 1)
+      continue;
+    memcpy(copy, page, sizeof *copy);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&page->sequence, __ATOMIC_RELAXED);
+    if (before == after)
+      return 1;
+  }
+
+  return 0;
+}
+
+static const char *state_name(int state) {
+  switch (state) {
+  case RUNNING:
+    return "running";
+  case KILLING:
+    return "killing";
+  case FROZEN:
+    return "frozen";
+  default:
+    return "unknown";
+  }
+}
+
+static void print_status_page(const StatusPage *page, double now) {
+  char program[sizeof page->program + 1];
+  const char *state;
+
+  memcpy(program, page->program, sizeof page->program);
+  program[sizeof page->program] = 0;
+
+  if (now - page->updated > STATUS_PAGE_STALE)
+    state = "stale";
+  else
+    state = state_name(page->state);
+
+  printf("%7d %7d %-8s %9.2f %9.0f %9.2f %9.0f %7.0f %7.0f %6.2f %5d %s\n",
+	 page->pid, page->child, state, page->time, page->time_limit,
+	 page->real, page->real_time_limit, page->memory, page->space_limit,
+	 page->load, page->processes, program);
+}
+
+static void top(runlim_ctx *ctx, const char *dir_name) {
+  char path[PATH_MAX];
+  StatusPage copy;
+  struct dirent *de;
+  struct stat buf;
+  const void *map;
+  long jobs = 0;
+  double now;
+  DIR *dir;
+  int fd;
+
+  dir = opendir(dir_name);
+  if (!dir)
+    error(ctx, "can not open status page directory '%s'", dir_name);
+
+  printf("%7s %7s %-8s %9s %9s %9s %9s %7s %7s %6s %5s %s\n", "PID",
+	 "CHILD", "STATE", "TIME", "LIMIT", "REAL", "LIMIT", "MB", "LIMIT",
+	 "LOAD", "PROCS", "PROGRAM");
+
+  now = wall_clock_time();
+
+  while ((de = readdir(dir)) != NULL) {
+    if (strncmp(de->d_name, "runlim.", 7))
+      continue;
+    snprintf(path, sizeof path, "%s/%s", dir_name, de->d_name);
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+      continue;
+    if (fstat(fd, &buf) || buf.st_size < (off_t)sizeof copy) {
+      (void)close(fd);
+      continue;
+    }
+    map = mmap(0, sizeof copy, PROT_READ, MAP_SHARED, fd, 0);
+    (void)close(fd);
+    if (map == MAP_FAILED)
+      continue;
+    if (read_status_page(map, &copy) && copy.magic == STATUS_PAGE_MAGIC &&
+	copy.version == STATUS_PAGE_VERSION) {
+      print_status_page(&copy, now);
+      jobs++;
+    }
+    (void)munmap((void *)map, sizeof copy);
+  }
+
+  (void)closedir(dir);
+
+  printf("%ld jobs\n", jobs);
+  fflush(stdout);
+}
+
+/*------------------------------------------------------------------------*/
+
+/* With '--energy' the package and DRAM energy counters of the RAPL power
+ * capping zones in '<sysfs>/class/powercap/intel-rapl:*' are read at the
+ * start, at each report and at the end of a run.  The counters wrap around
+ * at 'max_energy_range_uj', which is taken into account assuming that they
+ * wrap at most once between two reads.  Since these counters cover the
+ * whole socket, the power drawn while the program is not yet running is
+ * measured for 'ENERGY_BASELINE' milliseconds before starting it.  This
+ * baseline is only measured once per supervision, i.e., it is shared by
+ * all repeated, warmup and queued runs, which otherwise would all be
+ * delayed by the measurement.  The energy of the job is then estimated by
+ * subtracting this baseline and apportioning the rest by the share of the
+ * process time of the program in the busy time of all CPUs (from
+ * '/proc/stat').
+ */
+
+struct Zone {
+  char path[PATH_MAX];
+  char name[32];
+  long long range;
+  long long last;
+  double joules;
+};
+
+static int read_long_long_file(const char *path, long long *res_ptr) {
+  FILE *file = fopen(path, "r");
+  int res;
+  if (!file)
+    return 0;
+  res = fscanf(file, "%lld", res_ptr) == 1;
+  fclose(file);
+  return res;
+}
+
+static int read_zone_counter(Zone *zone, long long *res_ptr) {
+  char path[PATH_MAX + 16];
+  snprintf(path, sizeof path, "%s/energy_uj", zone->path);
+  return read_long_long_file(path, res_ptr);
+}
+
+static void find_zones(runlim_ctx *ctx) {
+  char path[PATH_MAX + 32], name[32];
+  struct dirent *de;
+  Zone *zone;
+  FILE *file;
+  DIR *dir;
+
+  ctx->zones_searched = 1;
+
+  snprintf(path, sizeof path, "%s/class/powercap", ctx->sysfs_root);
+  dir = opendir(path);
+  if (!dir)
+    return;
+
+  while ((de = readdir(dir)) != NULL) {
+    if (strncmp(de->d_name, "intel-rapl:", 11))
+      continue;
+    snprintf(path, sizeof path, "%s/class/powercap/%s/name", ctx->sysfs_root,
+	     de->d_name);
+    file = fopen(path, "r");
+    if (!file)
+      continue;
+    if (fscanf(file, "%31s", name) != 1)
+      name[0] = 0;
+    fclose(file);
+    if (strncmp(name, "package", 7) && strcmp(name, "dram"))
+      continue;
+    ctx->zones = realloc(ctx->zones, (ctx->num_zones + 1) * sizeof *ctx->zones);
+    if (!ctx->zones)
+      error(ctx, "out-of-memory allocating energy zones");
+    zone = ctx->zones + ctx->num_zones;
+    snprintf(zone->path, sizeof zone->path, "%s/class/powercap/%s",
+	     ctx->sysfs_root, de->d_name);
+    strcpy(zone->name, name);
+    snprintf(path, sizeof path, "%s/max_energy_range_uj", zone->path);
+    if (!read_long_long_file(path, &zone->range))
+      zone->range = 0;
+    if (!read_zone_counter(zone, &zone->last))
+      continue;
+    debug(ctx, "energy", "zone '%s' %s", zone->name, zone->path);
+    ctx->num_zones++;
+  }
+
+  (void)closedir(dir);
+}
+
+static void sample_energy(runlim_ctx *ctx) {
+  long long counter, delta;
+  Zone *zone;
+
+  for (zone = ctx->zones; zone < ctx->zones + ctx->num_zones; zone++) {
+    if (!read_zone_counter(zone, &counter))
+      continue;
+    delta = counter - zone->last;
+    if (delta < 0)
+      delta += zone->range + 1;
+    zone->joules += 1e-6 * delta;
+    zone->last = counter;
+  }
+}
+
+static double joules(runlim_ctx *ctx) {
+  double res = 0;
+  Zone *zone;
+  for (zone = ctx->zones; zone < ctx->zones + ctx->num_zones; zone++)
+    res += zone->joules;
+  return res;
+}
+
+static void reset_joules(runlim_ctx *ctx) {
+  Zone *zone;
+  for (zone = ctx->zones; zone < ctx->zones + ctx->num_zones; zone++)
+    zone->joules = 0;
+}
+
+// Sum of the non-idle times of all CPUs in seconds.
+
+static double read_busy_time(runlim_ctx *ctx) {
+  unsigned long long value, busy = 0;
+  FILE *file;
+  int column;
+
+  file = fopen("/proc/stat", "r");
+  if (!file)
+    return 0;
+
+  if (fscanf(file, "cpu") != EOF)
+    for (column = 0; column < 8 && fscanf(file, "%llu", &value) == 1;
+	 column++)
+      if (column != 3 && column != 4) // not 'idle' nor 'iowait'
+	busy += value;
+
+  fclose(file);
+
+  return busy / (double)ctx->clock_ticks;
+}
+
+static void measure_energy_baseline(runlim_ctx *ctx) {
+  double start, seconds;
+
+  sample_energy(ctx);
+  reset_joules(ctx);
+  start = wall_clock_time();
+  usleep(ENERGY_BASELINE * 1000);
+  sample_energy(ctx);
+  seconds = wall_clock_time() - start;
+  ctx->energy_baseline = seconds > 0 ? joules(ctx) / seconds : 0;
+  debug(ctx, "energy", "baseline %.1f watts", ctx->energy_baseline);
+}
+
+static void start_energy(runlim_ctx *ctx) {
+  if (!ctx->zones_searched) {
+    find_zones(ctx);
+    if (ctx->num_zones)
+      measure_energy_baseline(ctx);
+  }
+
+  if (!ctx->num_zones) {
+    warning(ctx, "no RAPL energy counters found in '%s/class/powercap'",
+	    ctx->sysfs_root);
+    return;
+  }
+
+  sample_energy(ctx);
+  reset_joules(ctx);
+
+  ctx->energy_start = wall_clock_time();
+  ctx->busy_time_start = read_busy_time(ctx);
+}
+
+static void report_energy(runlim_ctx *ctx, double time) {
+  double total, seconds, busy, share, job;
+
+  if (!ctx->num_zones)
+    return;
+
+  sample_energy(ctx);
+
+  total = joules(ctx);
+  seconds = wall_clock_time() - ctx->energy_start;
+  busy = read_busy_time(ctx) - ctx->busy_time_start;
+  share = busy > 0 ? time / busy : 0;
+  if (share > 1)
+    share = 1;
+  job = (total - ctx->energy_baseline * seconds) * share;
+  if (job < 0)
+    job = 0;
+
+  message(ctx, "energy", "%.1f joules (%.1f watts average)", total,
+	  seconds > 0 ? total / seconds : 0);
+  message(ctx, "baseline", "%.1f watts", ctx->energy_baseline);
+  message(ctx, "job energy", "%.1f joules (%.0f%% CPU share)", job,
+	  100 * share);
+}
+
+/*------------------------------------------------------------------------*/
+
+/* Touches the currently running queue job (see 'work_on_queue') regularly
+ * during sampling as heartbeat.
+ */
+
+static void queue_heartbeat(runlim_ctx *ctx) {
+  double now = wall_clock_time();
+  if (now - ctx->last_queue_heartbeat < QUEUE_HEARTBEAT)
+    return;
+  if (utimensat(AT_FDCWD, ctx->queue_heartbeat_path, 0, 0))
+    warning(ctx, "could not touch queue job '%s'", ctx->queue_heartbeat_path);
+  ctx->last_queue_heartbeat = now;
+}
+
+static void soft_signal_process(runlim_ctx *ctx, Process *p) {
+  assert(p->pid != ctx->parent_pid);
+  debug(ctx, "soft signal", "%d", p->pid);
+  signal_process(ctx, p, ctx->soft_signal);
+}
+
+// The notification socket is not blocking and never raises 'SIGPIPE'.
+
+static void fire_soft_limit(runlim_ctx *ctx, const char *name, double value) {
+  char line[64];
+  int len;
+
+  if (ctx->soft_signal)
+    (void)signal_all_child_processes(ctx, soft_signal_process);
+
+  if (ctx->soft_socket[0] >= 0) {
+    len = snprintf(line, sizeof line, "%s %.2f\n", name, value);
+    if (send(ctx->soft_socket[0], line, len,
+	     MSG_DONTWAIT | MSG_NOSIGNAL) != len)
+      debug(ctx, "soft", "could not write notification");
+  }
+}
+
+static void check_soft_limits(runlim_ctx *ctx) {
+  if (ctx->soft_time_limit && ctx->soft_time_fired < 0 &&
+      ctx->sampled_time > ctx->soft_time_limit) {
+    ctx->soft_time_fired = real_time(ctx);
+    ctx->soft_time_value = ctx->sampled_time;
+    fire_soft_limit(ctx, "soft-time-limit", ctx->sampled_time);
+  }
+  if (ctx->soft_space_limit && ctx->soft_space_fired < 0 &&
+      ctx->sampled_memory > ctx->soft_space_limit) {
+    ctx->soft_space_fired = real_time(ctx);
+    ctx->soft_space_value = ctx->sampled_memory;
+    fire_soft_limit(ctx, "soft-space-limit", ctx->sampled_memory);
+  }
+}
+
+static void report_soft_limit(runlim_ctx *ctx, const char *type, double fired,
+			      double value, const char *unit) {
+  if (fired < 0)
+    message(ctx, type, "not reached");
+  else
+    message(ctx, type, "reached after %.2f seconds at %.2f %s", fired, value,
+	    unit);
+}
+
+// Posts the current sample to the callback thread of the library context
+// (see 'callback_thread_main').  The sampler mutex is held.
+
+static void post_sample(runlim_ctx *ctx, double load) {
+  runlim_sample *sample = &ctx->sample;
+  sample->sample = ctx->num_samples;
+  sample->real = real_time(ctx);
+  sample->time = ctx->sampled_time;
+  sample->space = ctx->sampled_memory;
+  sample->load = load;
+  sample->processes = ctx->sampled_processes;
+  sample->threads = ctx->sampled_threads;
+  ctx->posted++;
+  (void)sem_post(&ctx->samples);
+}
+
+// After an error under the sampler mutex in the library sampling is
+// stopped and the child killed, which lets the supervising thread finish
+// the job as terminated.  The child is reaped by the supervising thread.
+
+static void abandon_run(runlim_ctx *ctx) {
+  ctx->sampling = 0;
+  pthread_cond_signal(&ctx->sampler_wakeup);
+  ctx->terminate_requested = 1;
+  ctx->caught_terminate = 1;
+  if (ctx->cgroup_path)
+    (void)write_cgroup_file(ctx, "cgroup.kill", "1\n");
+  if (ctx->child_pid > 0 && !ctx->child_reaped)
+    (void)kill(ctx->child_pid, SIGKILL);
+}
+
+static void sample_all_child_processes(runlim_ctx *ctx) {
+  sigjmp_buf *previous = recovery;
+  long sampled, read, exits;
+  double load, real;
+  sigjmp_buf recover;
+  Process *p;
+  int ignore;
+
+  assert(getpid() == ctx->parent_pid);
+
+  if (ctx->queue_heartbeat_path)
+    queue_heartbeat(ctx);
+
+  pthread_mutex_lock(&ctx->killing_mutex);
+  ignore = ctx->killing;
+  pthread_mutex_unlock(&ctx->killing_mutex);
+
+  if (ignore)
+    return;
+
+  pthread_mutex_lock(&ctx->sampler_mutex);
+
+  if (ctx->frozen) {
+    update_status_page(ctx, FROZEN, 0, ctx->last_load);
+    pthread_mutex_unlock(&ctx->sampler_mutex);
+    return;
+  }
+
+  if (sigsetjmp(recover, 0)) {
+    recovery = previous;
+    abandon_run(ctx);
+    pthread_mutex_unlock(&ctx->sampler_mutex);
+    return;
+  }
+  recovery = &recover;
+
+  load = ctx->last_load = sample_load(ctx);
+
+  ctx->num_samples++;
+
+  ctx->huge_pages_due =
+      ctx->num_samples_since_last_report + 1 >= ctx->report_rate;
+
+  if (ctx->thread_states) {
+    real = real_time(ctx);
+    ctx->thread_state_period = real - ctx->last_thread_state_sample;
+    ctx->last_thread_state_sample = real;
+  }
+
+  if (ctx->num_profile_events)
+    drain_profile(ctx);
+
+  exits = ctx->taskstats_socket >= 0 ? drain_taskstats(ctx) : 0;
+
+  read = read_processes(ctx);
+  connect_process_tree(ctx);
+
+  ctx->sampled_time = ctx->sampled_memory = ctx->sampled_wait = 0;
+  ctx->sampled_voluntary = ctx->sampled_involuntary = 0;
+  ctx->sampled_processes = ctx->sampled_threads = 0;
+  ctx->sampled_minor_faults = ctx->sampled_major_faults = 0;
+  ctx->sampled_swap = ctx->sampled_huge = 0;
+  memset(&ctx->sampled_io, 0, sizeof ctx->sampled_io);
+
+  if (read > 0) {
+    p = find_process(ctx, ctx->child_pid);
+    sampled = sample_recursively(ctx, p);
+
+    for (p = ctx->active_processes; p; p = p->next_process)
+      if (p->active && is_root_zombie(ctx, p))
+	sampled += sample_recursively(ctx, p);
+  } else
+    sampled = 0;
+
+  debug(ctx, "sampled", "%ld processes", sampled);
+
+  if (ctx->cpu_frequency && sampled > 0)
+    sample_frequency(ctx);
+
+  sampled += flush_inactive_processes(ctx);
+  ctx->sampled_time += ctx->accumulated_time;
+  ctx->sampled_wait += ctx->accumulated_wait;
+  ctx->sampled_voluntary += ctx->accumulated_voluntary;
+  ctx->sampled_involuntary += ctx->accumulated_involuntary;
+
+  add_io(&ctx->sampled_io, &ctx->accumulated_io);
+
+  if (ctx->swap_in_space)
+    ctx->sampled_memory += ctx->sampled_swap;
+
+  if (sampled > 0 || exits > 0) {
+    if (ctx->sampled_memory > ctx->max_memory)
+      ctx->max_memory = ctx->sampled_memory;
+
+    if (ctx->sampled_time > ctx->max_time)
+      ctx->max_time = ctx->sampled_time;
+
+    if (ctx->sampled_wait > ctx->max_wait)
+      ctx->max_wait = ctx->sampled_wait;
+
+    if (ctx->sampled_voluntary > ctx->max_voluntary)
+      ctx->max_voluntary = ctx->sampled_voluntary;
+
+    if (ctx->sampled_involuntary > ctx->max_involuntary)
+      ctx->max_involuntary = ctx->sampled_involuntary;
+
+    if (ctx->sampled_processes > ctx->max_process_count)
+      ctx->max_process_count = ctx->sampled_processes;
+
+    if (ctx->sampled_threads > ctx->max_thread_count)
+      ctx->max_thread_count = ctx->sampled_threads;
+
+    if (ctx->sampled_minor_faults > ctx->max_minor_faults)
+      ctx->max_minor_faults = ctx->sampled_minor_faults;
+
+    if (ctx->sampled_major_faults > ctx->max_major_faults)
+      ctx->max_major_faults = ctx->sampled_major_faults;
+
+    if (ctx->sampled_swap > ctx->max_swap)
+      ctx->max_swap = ctx->sampled_swap;
+
+    if (ctx->sampled_huge > ctx->max_huge)
+      ctx->max_huge = ctx->sampled_huge;
+
+    if (ctx->io_accounting)
+      sample_io(ctx, wall_clock_time());
+
+    if (ctx->callback)
+      post_sample(ctx, load);
+  }
+
+  if (++ctx->num_samples_since_last_report >= ctx->report_rate) {
+    ctx->num_samples_since_last_report = 0;
+    if (ctx->energy)
+      sample_energy(ctx);
+    if (sampled > 0) {
+      print_process_tree(ctx, find_process(ctx, ctx->child_pid));
+      report(ctx, ctx->sampled_time, ctx->sampled_memory, load);
+    }
+  }
+
+  if (ctx->terminate_requested) {
+    if (!ctx->caught_terminate) {
+      ctx->caught_terminate = 1;
+      kill_all_child_processes(ctx);
+    }
+  } else if (ctx->output_limit_exceeded) {
+    if (!ctx->caught_out_of_output) {
+      ctx->caught_out_of_output = 1;
+      kill_all_child_processes(ctx);
+    }
+  } else if (sampled > 0) {
+    check_soft_limits(ctx);
+    if (ctx->sampled_time > ctx->time_limit ||
+	real_time(ctx) > ctx->real_time_limit) {
+      if (!ctx->caught_out_of_time) {
+	ctx->caught_out_of_time = 1;
+	kill_all_child_processes(ctx);
+      }
+    } else if (ctx->sampled_memory > ctx->space_limit) {
+      if (!ctx->caught_out_of_memory) {
+	ctx->caught_out_of_memory = 1;
+	kill_all_child_processes(ctx);
+      }
+    } else if ((ctx->process_limit &&
+		ctx->sampled_processes > ctx->process_limit) ||
+	       (ctx->thread_limit &&
+		ctx->sampled_threads > ctx->thread_limit)) {
+      if (!ctx->caught_out_of_processes) {
+	ctx->caught_out_of_processes = 1;
+	kill_all_child_processes(ctx);
+      }
+    }
+  }
+
+  if (ctx->caught_out_of_time || ctx->caught_out_of_memory ||
+      ctx->caught_terminate || ctx->caught_out_of_output ||
+      ctx->caught_out_of_processes)
+    update_status_page(ctx, KILLING, sampled, load);
+  else
+    update_status_page(ctx, RUNNING, sampled, load);
+
+  recovery = previous;
+  pthread_mutex_unlock(&ctx->sampler_mutex);
+}
+
+/* Processes killed at the end of a run have not been sampled since and
+ * their exit records arrive after the last sample.  Thus we drain the
+ * remaining records and let the exact times of the still active processes
+ * raise the maximum time.
+ */
+
+static void finish_taskstats(runlim_ctx *ctx) {
+  double time;
+  Process *p;
+
+  pthread_mutex_lock(&ctx->sampler_mutex);
+  (void)drain_taskstats(ctx);
+  time = ctx->accumulated_time;
+  for (p = ctx->active_processes; p; p = p->next_process)
+    if (p->counted)
+      time += p->exited ? p->exit_time : p->time;
+  if (time > ctx->max_time)
+    ctx->max_time = time;
+  pthread_mutex_unlock(&ctx->sampler_mutex);
+}
+
+/* Each job is sampled by its own sampler thread, which blocks all signals
+ * and sleeps on a condition variable (with a monotonic clock) until the
+ * next sample is due.  Like with an interval timer samples are skipped if
+ * sampling takes longer than the sample rate.  The control thread wakes it
+ * up to apply a new sample rate and the supervising thread to stop it.
+ */
+
+static void advance_deadline(runlim_ctx *ctx, struct timespec *deadline) {
+  deadline->tv_sec += ctx->sample_rate / 1000000;
+  deadline->tv_nsec += 1000 * (ctx->sample_rate % 1000000);
+  if (deadline->tv_nsec >= 1000000000) {
+    deadline->tv_nsec -= 1000000000;
+    deadline->tv_sec++;
+  }
+}
+
+static void next_deadline(runlim_ctx *ctx, struct timespec *deadline) {
+  struct timespec now;
+  advance_deadline(ctx, deadline);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (deadline->tv_sec < now.tv_sec ||
+      (deadline->tv_sec == now.tv_sec && deadline->tv_nsec < now.tv_nsec)) {
+    *deadline = now;
+    advance_deadline(ctx, deadline);
+  }
+}
+
+static void *sampler_thread_main(void *ptr) {
+  runlim_ctx *ctx = ptr;
+  struct timespec deadline;
+
+  pthread_mutex_lock(&ctx->sampler_mutex);
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  advance_deadline(ctx, &deadline);
+
+  while (ctx->sampling) {
+    if (ctx->rearm_sampler) {
+      ctx->rearm_sampler = 0;
+      clock_gettime(CLOCK_MONOTONIC, &deadline);
+      advance_deadline(ctx, &deadline);
+    }
+    if (pthread_cond_timedwait(&ctx->sampler_wakeup, &ctx->sampler_mutex,
+			       &deadline) != ETIMEDOUT)
+      continue;
+    pthread_mutex_unlock(&ctx->sampler_mutex);
+    sample_all_child_processes(ctx);
+    pthread_mutex_lock(&ctx->sampler_mutex);
+    next_deadline(ctx, &deadline);
+  }
+
+  pthread_mutex_unlock(&ctx->sampler_mutex);
+
+  return 0;
+}
+
+static void start_sampler(runlim_ctx *ctx) {
+  sigset_t all, old;
+  int res;
+
+  assert(!ctx->sampler_started);
+  pthread_mutex_lock(&ctx->sampler_mutex);
+  ctx->sampling = 1;
+  ctx->rearm_sampler = 0;
+  pthread_mutex_unlock(&ctx->sampler_mutex);
+
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  res = pthread_create(&ctx->sampler_thread, 0, sampler_thread_main, ctx);
+  pthread_sigmask(SIG_SETMASK, &old, 0);
+
+  if (res)
+    error(ctx, "can not start sampler thread");
+  ctx->sampler_started = 1;
+}
+
+static void stop_sampler(runlim_ctx *ctx) {
+  if (!ctx->sampler_started)
+    return;
+  pthread_mutex_lock(&ctx->sampler_mutex);
+  ctx->sampling = 0;
+  pthread_cond_signal(&ctx->sampler_wakeup);
+  pthread_mutex_unlock(&ctx->sampler_mutex);
+  pthread_join(ctx->sampler_thread, 0);
+  ctx->sampler_started = 0;
+}
+
+/*------------------------------------------------------------------------*/
+
+/* The control socket allows to change limits and rates of a running job
+ * and to trigger reports.  Commands are read line by line by a separate
+ * control thread, which blocks all signals, and are applied while holding
+ * the sampler mutex, thus atomically with respect to sampling.  Commands
+ * reading the process table ('tree', 'pause', 'resume' and 'terminate')
+ * only touch processes while the sampler runs, since the supervising
+ * thread tears down the job after stopping it.
+ */
+
+#define CONTROL_HELP                                                           \
+  "commands:\n"                                                                \
+  "  time-limit <seconds>\n"                                                   \
+  "  real-time-limit <seconds>\n"                                              \
+  "  space-limit <MB>\n"                                                       \
+  "  sample-rate <microseconds>\n"                                             \
+  "  report-rate <samples>\n"                                                  \
+  "  report\n"                                                                 \
+  "  tree\n"                                                                   \
+  "  pause\n"                                                                  \
+  "  resume\n"                                                                 \
+  "  terminate\n"                                                              \
+  "  help\n"
+
+// A socket file left behind by a killed run makes 'bind' fail.  It is
+// removed unless it is not a socket or somebody still listens on it.
+
+static void remove_stale_control_socket(runlim_ctx *ctx,
+					struct sockaddr_un *address) {
+  struct stat buf;
+  int fd;
+
+  if (lstat(ctx->control_path, &buf) || !S_ISSOCK(buf.st_mode))
+    return;
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return;
+
+  if (connect(fd, (struct sockaddr *)address, sizeof *address) &&
+      errno == ECONNREFUSED) {
+    debug(ctx, "control", "removing stale socket '%s'", ctx->control_path);
+    (void)unlink(ctx->control_path);
+  }
+
+  (void)close(fd);
+}
+
+static void open_control_socket(runlim_ctx *ctx) {
+  struct sockaddr_un address;
+
+  assert(ctx->control_path);
+
+  if (strlen(ctx->control_path) >= sizeof address.sun_path)
+    error(ctx, "control socket path '%s' too long", ctx->control_path);
+
+  memset(&address, 0, sizeof address);
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, ctx->control_path);
+
+  ctx->control_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (ctx->control_socket < 0)
+    error(ctx, "can not create control socket");
+
+  remove_stale_control_socket(ctx, &address);
+
+  // Closed here on failure, since the socket file might be in use by
+  // another job and must not be removed in 'close_control_socket'.
+
+  if (bind(ctx->control_socket, (struct sockaddr *)&address, sizeof address)) {
+    (void)close(ctx->control_socket);
+    ctx->control_socket = -1;
+    error(ctx, "can not bind control socket to '%s'", ctx->control_path);
+  }
+
+  if (listen(ctx->control_socket, 4))
+    error(ctx, "can not listen on control socket '%s'", ctx->control_path);
+}
+
+// Replies are sent with 'MSG_NOSIGNAL', since a client closing its end
+// early must not raise 'SIGPIPE' in the process of the caller.
+
+static void reply(int fd, const char *fmt, ...) {
+  char line[512];
+  va_list ap;
+  int len;
+  va_start(ap, fmt);
+  len = vsnprintf(line, sizeof line, fmt, ap);
+  va_end(ap);
+  if (len >= (int)sizeof line)
+    len = sizeof line - 1;
+  if (len > 0)
+    (void)send(fd, line, len, MSG_NOSIGNAL);
+}
+
+static void send_process_tree(int fd, Process *p) {
+  Process *c;
+  reply(fd, "%d -> %d\n", p->ppid, p->pid);
+  for (c = p->first_child; c; c = c->next_sibbling)
+    send_process_tree(fd, c);
+}
+
+static int parse_control_number(const char *arg, long *res_ptr) {
+  while (*arg == ' ')
+    arg++;
+  return is_positive_long(arg, res_ptr);
+}
+
+static void execute_control_command(runlim_ctx *ctx, int fd, char *line) {
+  sigjmp_buf *previous = recovery;
+  sigjmp_buf recover;
+  const char *arg;
+  char *command;
+  Process *p;
+  long value;
+
+  command = line;
+  arg = strchr(line, ' ');
+  if (arg)
+    *(char *)arg++ = 0;
+  else
+    arg = "";
+
+  debug(ctx, "control", "%s %s", command, arg);
+
+  pthread_mutex_lock(&ctx->sampler_mutex);
+
+  if (sigsetjmp(recover, 0)) {
+    recovery = previous;
+    abandon_run(ctx);
+    pthread_mutex_unlock(&ctx->sampler_mutex);
+    reply(fd, "error: command '%s' failed\n", command);
+    return;
+  }
+  recovery = &recover;
+
+  if (!strcmp(command, "time-limit")) {
+    if (!parse_control_number(arg, &value))
+      goto INVALID_ARGUMENT;
+    ctx->time_limit = value;
+    message(ctx, "time limit", "%.0f seconds", ctx->time_limit);
+  } else if (!strcmp(command, "real-time-limit")) {
+    if (!parse_control_number(arg, &value))
+      goto INVALID_ARGUMENT;
+    ctx->real_time_limit = value;
+    message(ctx, "real time limit", "%.0f seconds", ctx->real_time_limit);
+  } else if (!strcmp(command, "space-limit")) {
+    if (!parse_control_number(arg, &value))
+      goto INVALID_ARGUMENT;
+    ctx->space_limit = value;
+    message(ctx, "space limit", "%.0f MB", ctx->space_limit);
+  } else if (!strcmp(command, "sample-rate")) {
+    if (!parse_control_number(arg, &value) || value <= 0)
+      goto INVALID_ARGUMENT;
+    ctx->sample_rate = value;
+    ctx->rearm_sampler = 1;
+    pthread_cond_signal(&ctx->sampler_wakeup);
+    message(ctx, "sample rate", "%ld microseconds", ctx->sample_rate);
+  } else if (!strcmp(command, "report-rate")) {
+    if (!parse_control_number(arg, &value) || value <= 0)
+      goto INVALID_ARGUMENT;
+    ctx->report_rate = value;
+    message(ctx, "report rate", "%ld samples", ctx->report_rate);
+  } else if (!strcmp(command, "report")) {
+    report(ctx, ctx->sampled_time, ctx->sampled_memory, ctx->last_load);
+    reply(fd, "%.2f time, %.2f real, %.0f MB, %.2f load\n", ctx->sampled_time,
+	    real_time(ctx), ctx->sampled_memory, ctx->last_load);
+  } else if (!strcmp(command, "tree")) {
+    p = ctx->sampling && ctx->size_of_process_hash_table
+	    ? *look_up_process_in_process_hash_table(ctx, ctx->child_pid)
+	    : 0;
+    if (p && p->active)
+      send_process_tree(fd, p);
+    else
+      reply(fd, "no processes\n");
+  } else if (!strcmp(command, "pause")) {
+    if (!ctx->sampling)
+      reply(fd, "no job running\n");
+    else if (freeze_child_processes(ctx))
+      message(ctx, "pause", "%.2f real", real_time(ctx));
+  } else if (!strcmp(command, "resume")) {
+    if (!ctx->sampling)
+      reply(fd, "no job running\n");
+    else if (thaw_child_processes(ctx))
+      message(ctx, "resume", "%.2f real", real_time(ctx));
+  } else if (!strcmp(command, "terminate")) {
+    if (ctx->sampling)
+      (void)thaw_child_processes(ctx);
+    ctx->terminate_requested = 1;
+  } else if (!strcmp(command, "help")) {
+    reply(fd, "%s", CONTROL_HELP);
+  } else {
+    recovery = previous;
+    pthread_mutex_unlock(&ctx->sampler_mutex);
+    reply(fd, "error: invalid command '%s' (try 'help')\n", command);
+    return;
+  }
+
+  recovery = previous;
+  pthread_mutex_unlock(&ctx->sampler_mutex);
+  reply(fd, "ok\n");
+  return;
+
+INVALID_ARGUMENT:
+  recovery = previous;
+  pthread_mutex_unlock(&ctx->sampler_mutex);
+  reply(fd, "error: invalid argument '%s' to '%s'\n", arg, command);
+}
+
+static void serve_control_connection(runlim_ctx *ctx, int fd) {
+  char line[256];
+  size_t len = 0;
+  ssize_t bytes;
+  int cancel;
+  char ch;
+
+  while ((bytes = read(fd, &ch, 1)) == 1) {
+    if (ch == '\r')
+      continue;
+    if (ch != '\n') {
+      if (len + 1 < sizeof line)
+	line[len++] = ch;
+      continue;
+    }
+    line[len] = 0;
+    len = 0;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel);
+    execute_control_command(ctx, fd, line);
+    pthread_setcancelstate(cancel, 0);
+  }
+}
+
+static void close_control_connection(void *fd) { (void)close(*(int *)fd); }
+
+static void *control_thread_main(void *ptr) {
+  runlim_ctx *ctx = ptr;
+  int fd;
+  for (;;) {
+    fd = accept(ctx->control_socket, 0, 0);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+	continue;
+      break;
+    }
+    pthread_cleanup_push(close_control_connection, &fd);
+    serve_control_connection(ctx, fd);
+    pthread_cleanup_pop(1);
+  }
+  return 0;
+}
+
+static void start_control_thread(runlim_ctx *ctx) {
+  sigset_t all, old;
+  assert(ctx->control_socket >= 0);
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  if (pthread_create(&ctx->control_thread, 0, control_thread_main, ctx))
+    warning(ctx, "can not start control thread");
+  else
+    ctx->control_thread_started = 1;
+  pthread_sigmask(SIG_SETMASK, &old, 0);
+}
+
+static void close_control_socket(runlim_ctx *ctx) {
+  if (ctx->control_thread_started) {
+    pthread_cancel(ctx->control_thread);
+    pthread_join(ctx->control_thread, 0);
+    ctx->control_thread_started = 0;
+  }
+  if (ctx->control_socket >= 0) {
+    (void)unlink(ctx->control_path);
+    (void)close(ctx->control_socket);
+    ctx->control_socket = -1;
+  }
+}
+
+/*------------------------------------------------------------------------*/
+
+// Called in the child before executing the program with all signals
+// blocked.  Handlers installed by the caller (the command line tool or a
+// harness using the library) are reset to their default, while ignored
+// signals stay ignored, and the original signal mask is restored.
+
+static void reset_signal_handlers(const sigset_t *mask) {
+  struct sigaction action;
+  int s;
+
+  for (s = 1; s < NSIG; s++) {
+    if (sigaction(s, 0, &action))
+      continue;
+    if (!(action.sa_flags & SA_SIGINFO) &&
+	(action.sa_handler == SIG_DFL || action.sa_handler == SIG_IGN))
+      continue;
+    memset(&action, 0, sizeof action);
+    action.sa_handler = SIG_DFL;
+    (void)sigaction(s, &action, 0);
+  }
+
+  pthread_sigmask(SIG_SETMASK, mask, 0);
+}
+
+/*------------------------------------------------------------------------*/
+
+/* The layout of the address space of the program depends on address space
+ * layout randomization, which is disabled in the child with '--no-aslr',
+ * and the initial stack on the size of the environment.  With
+ * '--clean-env' only the variables in 'kept_environment' and those given
+ * with '--keep-env=<name>' are passed to the program.  With
+ * '--env-pad=<bytes>' the variable 'ENV_PAD' is added with a value padding
+ * the environment (strings including their terminating zero) to exactly
+ * the given number of bytes.
+ */
+
+#define ENV_PAD "RUNLIM_ENV_PAD"
+
+static const char *kept_environment[] = {"PATH", "HOME", "USER",
+					 "LANG", "LC_ALL", "TZ"};
+
+extern char **environ;
+
+static int matches_variable(const char *entry, const char *name) {
+  size_t len = strlen(name);
+  return !strncmp(entry, name, len) && entry[len] == '=';
+}
+
+static int keep_variable(runlim_ctx *ctx, const char *entry) {
+  size_t i;
+  if (matches_variable(entry, ENV_PAD))
+    return 0;
+  if (!ctx->clean_env)
+    return 1;
+  for (i = 0; i < sizeof kept_environment / sizeof *kept_environment; i++)
+    if (matches_variable(entry, kept_environment[i]))
+      return 1;
+  for (i = 0; i < ctx->keep_env.count; i++)
+    if (matches_variable(entry, ctx->keep_env.start[i]))
+      return 1;
+  return 0;
+}
+
+static void prepare_environment(runlim_ctx *ctx) {
+  size_t count = 0, needed, padding;
+  char **p, *pad;
+
+  for (p = environ; *p; p++)
+    count++;
+
+  ctx->environment = malloc((count + 2) * sizeof *ctx->environment);
+  if (!ctx->environment)
+    error(ctx, "out-of-memory allocating environment");
+
+  ctx->environment_variables = ctx->environment_bytes = 0;
+  for (p = environ; *p; p++)
+    if (keep_variable(ctx, *p)) {
+      ctx->environment[ctx->environment_variables++] = *p;
+      ctx->environment_bytes += strlen(*p) + 1;
+    }
+
+  if (ctx->env_pad) {
+    needed = strlen(ENV_PAD) + 2;
+    if (ctx->environment_bytes + needed > (size_t)ctx->env_pad)
+      error(ctx, "environment of %zu bytes does not fit into '--env-pad=%ld'",
+	    ctx->environment_bytes + needed, ctx->env_pad);
+    padding = ctx->env_pad - ctx->environment_bytes - needed;
+    pad = malloc(ctx->env_pad - ctx->environment_bytes);
+    if (!pad)
+      error(ctx, "out-of-memory allocating environment padding");
+    sprintf(pad, "%s=", ENV_PAD);
+    memset(pad + needed - 1, 'x', padding);
+    pad[needed - 1 + padding] = 0;
+    ctx->environment[ctx->environment_variables++] = pad;
+    ctx->environment_bytes = ctx->env_pad;
+  }
+
+  ctx->environment[ctx->environment_variables] = 0;
+}
+
+static void release_environment(runlim_ctx *ctx) {
+  if (ctx->env_pad && ctx->environment)
+    free(ctx->environment[ctx->environment_variables - 1]);
+  free(ctx->environment);
+  ctx->environment = 0;
+}
+
+// Called in the child before executing the program.
+
+static void setup_environment(runlim_ctx *ctx) {
+  int persona;
+  if (ctx->no_aslr) {
+    persona = personality(0xffffffff);
+    if (persona != -1)
+      (void)personality(persona | ADDR_NO_RANDOMIZE);
+  }
+  if (ctx->environment)
+    environ = ctx->environment;
+}
+
+/*------------------------------------------------------------------------*/
+
+/* With '--stdout=<file>' and '--stderr=<file>' the output of the program
+ * is sent through a pipe from which a writer thread moves the data to the
+ * file with 'splice', thus without copying it through user space.  If a
+ * stream exceeds '--output-limit' the rest of its output is discarded and
+ * the program is killed ('out of output').  Files ending in '.gz', '.bz2',
+ * '.xz' or '.zst' are written by a compressor process instead, which
+ * reads the spliced data from another pipe.  With '--stdin=<file>' the
+ * standard input of the program is read from the given file.
+ */
+
+static const char *compressor_for(const char *path) {
+  static const char *compressors[][2] = {
+      {".gz", "gzip"}, {".bz2", "bzip2"}, {".xz", "xz"}, {".zst", "zstd"}};
+  size_t len = strlen(path), i, n;
+  for (i = 0; i < sizeof compressors / sizeof *compressors; i++) {
+    n = strlen(compressors[i][0]);
+    if (len > n && !strcmp(path + len - n, compressors[i][0]))
+      return compressors[i][1];
+  }
+  return 0;
+}
+
+static void start_compressor(runlim_ctx *ctx, Stream *stream,
+			     const char *compressor) {
+  int compressor_pipe[2];
+
+  if (pipe2(compressor_pipe, O_CLOEXEC))
+    error(ctx, "can not create pipe to compressor '%s'", compressor);
+
+  stream->compressor = fork();
+  if (stream->compressor < 0)
+    error(ctx, "can not fork compressor '%s'", compressor);
+
+  if (!stream->compressor) {
+    (void)signal(SIGINT, SIG_IGN);
+    if (dup2(compressor_pipe[0], 0) < 0 || dup2(stream->file, 1) < 0)
+      _exit(1);
+    execlp(compressor, compressor, "-c", "-q", (char *)0);
+    _exit(1);
+  }
+
+  (void)close(compressor_pipe[0]);
+  (void)close(stream->file);
+  stream->file = compressor_pipe[1];
+
+  debug(ctx, stream->name, "compressor '%s' %d", compressor,
+	stream->compressor);
+}
+
+static void *stream_thread_main(void *ptr) {
+  Stream *stream = ptr;
+  runlim_ctx *ctx = stream->ctx;
+  const long long limit = ctx->output_limit * (1 << 20);
+  char chunk[STREAM_CHUNK];
+  int to, discarding;
+  long long len;
+  ssize_t n;
+
+  for (;;) {
+    len = STREAM_CHUNK;
+    discarding = stream->file < 0;
+    if (ctx->output_limit > 0 && stream->bytes >= limit)
+      discarding = 1;
+    if (discarding)
+      to = stream->discard;
+    else {
+      to = stream->file;
+      if (ctx->output_limit > 0 && limit - stream->bytes < len)
+	len = limit - stream->bytes;
+    }
+
+    // Falls back to copying if splicing is not supported for the file.
+
+    if (stream->copy) {
+      n = read(stream->pipe[0], chunk, len);
+      if (n > 0 && !discarding && write(to, chunk, n) != n)
+	n = -1;
+    } else
+      n = splice(stream->pipe[0], 0, to, 0, len,
+		 SPLICE_F_MOVE | SPLICE_F_MORE);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n < 0 && errno == EINVAL && !stream->copy) {
+      stream->copy = 1;
+      continue;
+    }
+
+    if (n < 0 && !discarding) {
+      warning(ctx, "could not write %s to '%s' (discarding rest)", stream->name,
+	      stream->path);
+      (void)close(stream->file);
+      stream->file = -1;
+      continue;
+    }
+
+    if (n <= 0)
+      break;
+
+    if (discarding) {
+      stream->discarded += n;
+      if (stream->file >= 0)
+	ctx->output_limit_exceeded = 1;
+    } else
+      stream->bytes += n;
+  }
+
+  stream->end = wall_clock_time();
+
+  return 0;
+}
+
+static void open_streams(runlim_ctx *ctx) {
+  const char *compressor;
+  Stream *stream;
+
+  if (ctx->stdin_path) {
+    ctx->stdin_file = open(ctx->stdin_path, O_RDONLY | O_CLOEXEC);
+    if (ctx->stdin_file < 0)
+      error(ctx, "can not open standard input file '%s'", ctx->stdin_path);
+  }
+
+  for (stream = ctx->streams; stream < ctx->streams + NUM_STREAMS; stream++) {
+    if (!stream->path)
+      continue;
+    stream->bytes = stream->discarded = 0;
+    stream->copy = 0;
+    stream->compressor = 0;
+    stream->file =
+	open(stream->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (stream->file < 0)
+      error(ctx, "can not write %s file '%s'", stream->name, stream->path);
+    stream->discard = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (stream->discard < 0)
+      error(ctx, "can not open '/dev/null'");
+    compressor = compressor_for(stream->path);
+    if (compressor)
+      start_compressor(ctx, stream, compressor);
+    if (pipe2(stream->pipe, O_CLOEXEC))
+      error(ctx, "can not create %s pipe", stream->name);
+    message(ctx, stream->name, "%s", stream->path);
+  }
+}
+
+// Called in the child before executing the program.
+
+static void redirect_streams(runlim_ctx *ctx) {
+  Stream *stream;
+  if (ctx->stdin_file >= 0 && dup2(ctx->stdin_file, 0) < 0)
+    _exit(1);
+  for (stream = ctx->streams; stream < ctx->streams + NUM_STREAMS; stream++)
+    if (stream->path && dup2(stream->pipe[1], stream->fd) < 0)
+      _exit(1);
+}
+
+static void start_stream_threads(runlim_ctx *ctx) {
+  sigset_t all, old;
+  Stream *stream;
+
+  if (ctx->stdin_file >= 0) {
+    (void)close(ctx->stdin_file);
+    ctx->stdin_file = -1;
+  }
+
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  for (stream = ctx->streams; stream < ctx->streams + NUM_STREAMS; stream++) {
+    if (!stream->path)
+      continue;
+    (void)close(stream->pipe[1]);
+    stream->pipe[1] = -1;
+    if (pthread_create(&stream->thread, 0, stream_thread_main, stream))
+      error(ctx, "can not start %s thread", stream->name);
+    stream->started = 1;
+  }
+  pthread_sigmask(SIG_SETMASK, &old, 0);
+}
+
+// Waits until all processes writing to the pipes are gone and the
+// compressors are done.  Needs to be called after killing all child
+// processes.
+
+static void close_streams(runlim_ctx *ctx) {
+  Stream *stream;
+  int status;
+
+  for (stream = ctx->streams; stream < ctx->streams + NUM_STREAMS; stream++) {
+    if (!stream->path)
+      continue;
+    if (stream->pipe[1] >= 0)
+      (void)close(stream->pipe[1]);
+    if (stream->started)
+      pthread_join(stream->thread, 0);
+    stream->started = 0;
+    (void)close(stream->pipe[0]);
+    stream->pipe[0] = stream->pipe[1] = -1;
+    (void)close(stream->discard);
+    stream->discard = -1;
+    if (stream->file >= 0)
+      (void)close(stream->file);
+    stream->file = -1;
+    if (stream->compressor > 0) {
+      while (waitpid(stream->compressor, &status, 0) < 0 && errno == EINTR)
+	;
+      if (!WIFEXITED(status) || WEXITSTATUS(status))
+	warning(ctx, "compressor of '%s' failed", stream->path);
+      stream->compressor = 0;
+    }
+  }
+}
+
+static void report_streams(runlim_ctx *ctx) {
+  double seconds, throughput;
+  Stream *stream;
+
+  for (stream = ctx->streams; stream < ctx->streams + NUM_STREAMS; stream++) {
+    if (!stream->path)
+      continue;
+    seconds = stream->end - ctx->start_time;
+    throughput = seconds > 0 ? stream->bytes / seconds / (1 << 20) : 0;
+    if (stream->discarded)
+      message(ctx, stream->name, "%lld bytes (%.1f MB/s, %lld discarded)",
+	      stream->bytes, throughput, stream->discarded);
+    else
+      message(ctx, stream->name, "%lld bytes (%.1f MB/s)", stream->bytes,
+	      throughput);
+  }
+}
+
+/*------------------------------------------------------------------------*/
+
+/* A run is considered to be noisy if the run-queue wait relative to the
+ * process time or some pressure stall relative to the real time exceeds
+ * the noisy threshold.  For memory and I/O only the 'full' stall counts,
+ * since 'some' also covers unrelated processes stalling.
+ */
+
+static void report_contention(runlim_ctx *ctx, double real) {
+  char reasons[256], type[32];
+  double ratio;
+  size_t i;
+
+  reasons[0] = 0;
+
+  ratio = ctx->max_time > 0 ? 100 * ctx->max_wait / ctx->max_time : 0;
+  message(ctx, "wait", "%.2f seconds (%.1f%% of time)", ctx->max_wait, ratio);
+  if (ratio > ctx->noisy_threshold)
+    sprintf(reasons + strlen(reasons), ", wait %.1f%%", ratio);
+
+  message(ctx, "switches", "%ld voluntary, %ld involuntary", ctx->max_voluntary,
+	  ctx->max_involuntary);
+
+  if (ctx->pressure_available) {
+    for (i = 0; i < PRESSURE_RESOURCES; i++) {
+      sprintf(type, "%s pressure", pressure_resources[i]);
+      message(ctx, type, "%.2f some, %.2f full seconds", ctx->pressure_some[i],
+	      ctx->pressure_full[i]);
+      if (real <= 0)
+	continue;
+      if (i)
+	ratio = 100 * ctx->pressure_full[i] / real;
+      else
+	ratio = 100 * ctx->pressure_some[i] / real;
+      if (ratio > ctx->noisy_threshold)
+	sprintf(reasons + strlen(reasons), ", %s %.1f%%",
+		pressure_resources[i], ratio);
+    }
+  }
+
+  if (reasons[0])
+    message(ctx, "contention", "noisy (%s)", reasons + 2);
+  else
+    message(ctx, "contention", "clean");
+}
+
+/*------------------------------------------------------------------------*/
+
+static const char *ctime_without_new_line(runlim_ctx *ctx, time_t *t) {
+  char str[32];
+  const char *p;
+  if (!ctime_r(t, str))
+    str[0] = 0;
+  ctx->pos_buffer = 0;
+  for (p = str; *p && *p != '\n'; p++)
+    push_buffer(ctx, *p);
+  push_buffer(ctx, 0);
+  return ctx->buffer;
+}
+
+/*------------------------------------------------------------------------*/
+
+typedef struct Run Run;
+
+struct Run {
+  Status status;
+  int result;
+  int signal;
+  double real;
+  double time;
+  double space;
+  char description[32];
+};
+
+/* Each run (repetition) starts with an empty process table and cleared
+ * statistics.  This is done while holding the sampler mutex, since the
+ * control thread might access them concurrently.
+ */
+
+static void reset_run(runlim_ctx *ctx) {
+  pthread_mutex_lock(&ctx->sampler_mutex);
+
+  release_process_hash_table(ctx);
+  ctx->active_processes = ctx->last_active_process = 0;
+
+  ctx->num_samples = ctx->num_reports = ctx->num_samples_since_last_report = 0;
+  ctx->max_time = ctx->max_memory = ctx->max_load = ctx->last_load = 0;
+  ctx->max_wait = 0;
+  ctx->max_voluntary = ctx->max_involuntary = 0;
+  ctx->max_process_count = ctx->max_thread_count = 0;
+  ctx->max_minor_faults = ctx->max_major_faults = 0;
+  ctx->max_swap = ctx->max_huge = 0;
+  reset_thread_states(ctx);
+  reset_io(ctx);
+  ctx->accumulated_time = ctx->accumulated_wait = 0;
+  ctx->accumulated_voluntary = ctx->accumulated_involuntary = 0;
+  ctx->children = 0;
+
+  ctx->killing = 0;
+  ctx->exec_failed = 0;
+  ctx->caught_out_of_memory = ctx->caught_out_of_time = 0;
+  ctx->caught_terminate = 0;
+  ctx->caught_out_of_output = ctx->output_limit_exceeded = 0;
+  ctx->caught_out_of_processes = 0;
+
+  ctx->soft_time_fired = ctx->soft_space_fired = -1;
+  ctx->soft_time_value = ctx->soft_space_value = 0;
+
+  ctx->frozen = 0;
+  ctx->frozen_time = 0;
+  ctx->freezes = 0;
+
+  ctx->frequency_sum = ctx->min_frequency = 0;
+  ctx->frequency_samples = 0;
+
+  pthread_mutex_unlock(&ctx->sampler_mutex);
+}
+
+static void run_program(runlim_ctx *ctx, char **program, Run *run) {
+  char signal_description[80];
+  const char *description;
+  struct rusage usage;
+  int res, status, s, ok;
+  int setup_pipe[2], exec_pipe[2];
+  sigset_t all, old;
+  int exec_errno;
+  ssize_t bytes;
+  double real;
+  time_t t;
+
+  reset_run(ctx);
+  memset(&usage, 0, sizeof usage);
+
+  if (ctx->cgroup_parent) {
+    create_cgroup(ctx);
+    message(ctx, "cgroup", "%s", ctx->cgroup_path);
+    install_io_max(ctx);
+    install_cpu_max(ctx);
+    install_memory_high(ctx);
+  }
+
+  install_task_limits(ctx);
+
+  if (ctx->contention)
+    start_pressure(ctx);
+
+  if (ctx->cpu_frequency)
+    init_frequency(ctx);
+
+  if (ctx->energy)
+    start_energy(ctx);
+
+  if (ctx->thp)
+    start_thp(ctx);
+
+  if (ctx->taskstats)
+    start_taskstats(ctx);
+
+  ok = OK; /* status of the runlim */
+  s = 0;   /* signal caught */
+
+  t = time(0);
+  message(ctx, "start", "%s", ctime_without_new_line(ctx, &t));
+
+  open_streams(ctx);
+
+  if (ctx->soft_fd >= 0 &&
+      socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, ctx->soft_socket))
+    error(ctx, "can not create soft limit notification socket");
+
+  // The child waits until the parent closes the write end of the setup
+  // pipe, which gives the parent the chance to finish setting up the child
+  // (moving it to the cgroup for instance) before the program is executed.
+  // If 'execvp' fails the child writes 'errno' to the exec pipe, which is
+  // otherwise closed by executing the program.  A failure to apply the
+  // transparent huge page policy is written as negative 'errno' before.
+  // Both are closed on 'exec', since children of other jobs of a library
+  // caller must not keep them.
+
+  if (pipe2(setup_pipe, O_CLOEXEC))
+    error(ctx, "can not create setup pipe");
+
+  if (pipe2(exec_pipe, O_CLOEXEC)) {
+    (void)close(setup_pipe[0]);
+    (void)close(setup_pipe[1]);
+    error(ctx, "can not create exec pipe");
+  }
+
+  ctx->start_time_tai = tai_time();
+  ctx->start_time = wall_clock_time();
+
+  // Signals are blocked until the child has reset the signal handlers of
+  // the caller, which thus never run in the child.
+
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+
+  ctx->child_reaped = 0;
+  ctx->child_pid = fork();
+
+  if (ctx->child_pid != 0) {
+    pthread_sigmask(SIG_SETMASK, &old, 0);
+    (void)close(setup_pipe[0]);
+    (void)close(exec_pipe[1]);
+    if (ctx->soft_socket[1] >= 0) {
+      (void)close(ctx->soft_socket[1]);
+      ctx->soft_socket[1] = -1;
+    }
+    start_stream_threads(ctx);
+    if (ctx->child_pid < 0) {
+      ctx->child_reaped = 1;
+      (void)close(setup_pipe[1]);
+      (void)close(exec_pipe[0]);
+      ok = FORK_FAILED;
+      res = 1;
+    } else {
+      status = 0;
+
+      if (!ctx->command_line)
+	ctx->group_pid = ctx->session_pid = ctx->child_pid;
+
+      if (ctx->cgroup_path && !join_cgroup(ctx, ctx->child_pid)) {
+	kill(ctx->child_pid, SIGKILL);
+	(void)close(exec_pipe[0]);
+	error(ctx, "can not move child %d to cgroup '%s'", ctx->child_pid,
+	      ctx->cgroup_path);
+      }
+
+      if (ctx->profile_path)
+	start_profile(ctx);
+
+      (void)close(setup_pipe[1]);
+
+      while ((bytes = read(exec_pipe[0], &exec_errno, sizeof exec_errno))) {
+	if (bytes < 0 && errno == EINTR)
+	  continue;
+	if (bytes != sizeof exec_errno)
+	  break;
+	if (exec_errno < 0)
+	  warning(ctx, "can not apply '--thp=%s' (%s)", thp_name(ctx),
+		  strerror(-exec_errno));
+	else
+	  ctx->exec_failed = 1;
+      }
+      (void)close(exec_pipe[0]);
+
+      message(ctx, "child", "%d", ctx->child_pid);
+
+      if (ctx->status_page_dir)
+	open_status_page(ctx, program[0]);
+      debug(ctx, "group", "%d", ctx->group_pid);
+      debug(ctx, "session", "%d", ctx->session_pid);
+      debug(ctx, "parent", "%d", ctx->parent_pid);
+
+      // The 'sampling' and killing of zombie processes relies on identifying
+      // group, session and other ancestor processes of the child process by
+      // comparing absolute numbers.  This assumes the following conditions.
+
+      if (!ctx->single && ctx->group_pid > ctx->child_pid)
+	error(ctx, "group pid %d larger than child pid %d", ctx->group_pid,
+	      ctx->child_pid);
+
+      if (!ctx->single && ctx->session_pid > ctx->child_pid)
+	error(ctx, "session pid %d larger than child pid %d", ctx->session_pid,
+	      ctx->child_pid);
+
+      usleep(10000);
+
+      start_sampler(ctx);
+
+      // Signals caught by the command line tool interrupt 'wait4' and
+      // the job is then killed here in the supervising thread.
+
+      for (;;) {
+	if (ctx->caught_other_signal) {
+	  run_under_sampler_mutex(ctx, thaw_all_child_processes);
+	  run_under_sampler_mutex(ctx, kill_all_child_processes);
+	}
+	if (wait4(ctx->child_pid, &status, 0, &usage) >= 0 || errno != EINTR)
+	  break;
+      }
+
+      stop_sampler(ctx);
+      ctx->child_reaped = 1;
+
+      if (WIFEXITED(status))
+	res = WEXITSTATUS(status);
+      else if (WIFSIGNALED(status)) {
+	s = WTERMSIG(status);
+	res = 128 + s;
+	switch (s) {
+	case SIGXFSZ:
+	  ok = OUT_OF_MEMORY;
+	  break;
+	case SIGXCPU:
+	  ok = OUT_OF_TIME;
+	  break;
+	case SIGSEGV:
+	  ok = SEGMENTATION_FAULT;
+	  break;
+	case SIGBUS:
+	  ok = BUS_ERROR;
+	  break;
+	default:
+	  ok = OTHER_SIGNAL;
+	  break;
+	}
+      } else {
+	ok = INTERNAL_ERROR;
+	res = 1;
+      }
+    }
+  } else {
+    char ch;
+    ctx->forked_child = 1;
+    reset_signal_handlers(&old);
+    if (!ctx->command_line)
+      (void)setsid();
+    redirect_streams(ctx);
+    pass_soft_socket(ctx);
+    setup_environment(ctx);
+    exec_errno = -apply_thp(ctx);
+    if (exec_errno)
+      (void)write(exec_pipe[1], &exec_errno, sizeof exec_errno);
+    (void)close(setup_pipe[1]);
+    while (read(setup_pipe[0], &ch, 1) < 0 && errno == EINTR)
+      ;
+    (void)close(setup_pipe[0]);
+    execvp(program[0], program);
+    exec_errno = errno;
+    (void)write(exec_pipe[1], &exec_errno, sizeof exec_errno);
+    _exit(1);
+  }
+
+  real = real_time(ctx);
+
+  if (ctx->exec_failed)
+    ok = EXEC_FAILED;
+  else if (ctx->caught_out_of_memory)
+    ok = OUT_OF_MEMORY;
+  else if (ctx->caught_out_of_time)
+    ok = OUT_OF_TIME;
+  else if (ctx->caught_terminate)
+    ok = TERMINATED;
+  else if (ctx->caught_out_of_output)
+    ok = OUT_OF_OUTPUT;
+  else if (ctx->caught_out_of_processes)
+    ok = OUT_OF_PROCESSES;
+
+  run_under_sampler_mutex(ctx, thaw_all_child_processes);
+
+  sample_all_child_processes(ctx);
+
+  if (ctx->contention)
+    stop_pressure(ctx);
+
+  run_under_sampler_mutex(ctx, kill_all_child_processes);
+
+  close_streams(ctx);
+
+  if (ctx->soft_socket[0] >= 0) {
+    (void)close(ctx->soft_socket[0]);
+    ctx->soft_socket[0] = -1;
+  }
+
+  if (ok == OK && ctx->output_limit_exceeded)
+    ok = OUT_OF_OUTPUT;
+
+  if (ok == OK && reached_pids_max(ctx))
+    ok = OUT_OF_PROCESSES;
+
+  if (ctx->taskstats_socket >= 0)
+    finish_taskstats(ctx);
+
+  read_cpu_stat(ctx);
+  read_memory_events(ctx);
+
+  remove_cgroup(ctx);
+
+  t = time(0);
+  message(ctx, "end", "%s", ctime_without_new_line(ctx, &t));
+
+  if (ctx->max_time >= ctx->time_limit ||
+      real_time(ctx) >= ctx->real_time_limit)
+    ok = OUT_OF_TIME;
+
+  switch (ok) {
+  case OK:
+    description = "ok";
+    break;
+  case OUT_OF_TIME:
+    description = "out of time";
+    res = 2;
+    break;
+  case OUT_OF_MEMORY:
+    description = "out of memory";
+    res = 3;
+    break;
+  case SEGMENTATION_FAULT:
+    description = "segmentation fault";
+    res = 4;
+    break;
+  case BUS_ERROR:
+    description = "bus error";
+    res = 5;
+    break;
+  case FORK_FAILED:
+    description = "fork failed";
+    res = 6;
+    break;
+  case INTERNAL_ERROR:
+    description = "internal error";
+    res = 7;
+    break;
+  case TERMINATED:
+    description = "terminated";
+    res = 8;
+    break;
+  case OUT_OF_OUTPUT:
+    description = "out of output";
+    res = 9;
+    break;
+  case OUT_OF_PROCESSES:
+    description = "out of processes";
+    res = 10;
+    break;
+  case EXEC_FAILED:
+    description = "execvp failed";
+    res = 1;
+    break;
+  default:
+    sprintf(signal_description, "signal(%d)", s);
+    description = signal_description;
+    res = 11;
+    break;
+  }
+
+  message(ctx, "status", description);
+  message(ctx, "result", "%d", res);
+  message(ctx, "children", "%d", ctx->children);
+  message(ctx, "processes", "%d", ctx->processes);
+  message(ctx, "tasks", "%ld processes, %ld threads maximum",
+	  ctx->max_process_count, ctx->max_thread_count);
+  message(ctx, "real", "%.2f seconds", real);
+  if (ctx->freezes)
+    message(ctx, "frozen", "%.2f seconds (%ld times)", ctx->frozen_time,
+	    ctx->freezes);
+  message(ctx, "time", "%.2f seconds", ctx->max_time);
+  if (ctx->cores)
+    message(ctx, "throttled", "%.2f seconds (%ld periods)", ctx->throttled_time,
+	    ctx->throttled_periods);
+  message(ctx, "space", "%.0f MB", ctx->max_memory);
+  if (ctx->soft_time_limit)
+    report_soft_limit(ctx, "soft time limit", ctx->soft_time_fired,
+		      ctx->soft_time_value, "seconds");
+  if (ctx->soft_space_limit)
+    report_soft_limit(ctx, "soft space limit", ctx->soft_space_fired,
+		      ctx->soft_space_value, "MB");
+  if (ctx->memory_high_events >= 0)
+    message(ctx, "memory high", "%ld events", ctx->memory_high_events);
+  if (ctx->energy)
+    report_energy(ctx, ctx->max_time);
+  message(ctx, "load", "%.2f maximum", ctx->max_load);
+  report_faults(ctx, real, &usage);
+  if (ctx->taskstats_socket >= 0)
+    report_taskstats(ctx);
+  stop_taskstats(ctx);
+  if (ctx->io_accounting)
+    report_io(ctx);
+  if (ctx->thp)
+    report_thp(ctx);
+  report_streams(ctx);
+  if (ctx->cpu_frequency)
+    report_frequency(ctx);
+  if (ctx->contention)
+    report_contention(ctx, real);
+  if (ctx->breakdown)
+    report_breakdown(ctx);
+  if (ctx->profile_path)
+    stop_profile(ctx);
+  if (ctx->thread_states)
+    report_thread_states(ctx);
+  message(ctx, "samples", "%ld", ctx->num_samples);
+  debug(ctx, "reports", "%ld", ctx->num_samples);
+
+  close_status_page(ctx);
+
+  if (ctx->cpu_frequency)
+    release_frequency(ctx);
+
+  run->status = ok;
+  run->result = res;
+  run->signal = s;
+  run->real = real;
+  run->time = ctx->max_time;
+  run->space = ctx->max_memory;
+  strncpy(run->description, description, sizeof run->description - 1);
+  run->description[sizeof run->description - 1] = 0;
+}
+
+/*------------------------------------------------------------------------*/
+
+/* With '--repeat' the program is run several times (after '--warmup'
+ * runs which are not taken into account) and statistics over the measured
+ * runs are reported.  The confidence interval is based on Student's
+ * t-distribution.  If '--repeat-ci' is given we stop early as soon the
+ * width of the confidence interval relative to the mean drops below the
+ * given percentage for both real and process time.
+ */
+
+/* The histogram of outcomes is keyed by the status of a run, since the
+ * set of statuses is small and fixed (all other signals share one slot).
+ */
+
+typedef struct Outcome Outcome;
+
+struct Outcome {
+  Status status;
+  const char *description;
+};
+
+static const Outcome outcomes[] = {
+    {OK, "ok"},
+    {OUT_OF_TIME, "out of time"},
+    {OUT_OF_MEMORY, "out of memory"},
+    {SEGMENTATION_FAULT, "segmentation fault"},
+    {BUS_ERROR, "bus error"},
+    {FORK_FAILED, "fork failed"},
+    {INTERNAL_ERROR, "internal error"},
+    {TERMINATED, "terminated"},
+    {OUT_OF_OUTPUT, "out of output"},
+    {OUT_OF_PROCESSES, "out of processes"},
+    {EXEC_FAILED, "execvp failed"},
+    {OTHER_SIGNAL, "other signal"},
+};
+
+#define NUM_OUTCOMES (sizeof outcomes / sizeof *outcomes)
+
+static void clear_outcomes(runlim_ctx *ctx) {
+  size_t i;
+  for (i = 0; i < NUM_OUTCOMES; i++)
+    ctx->outcome_counts[i] = 0;
+}
+
+static void record_run(runlim_ctx *ctx, Run *run) {
+  size_t i;
+
+  ctx->real_times[ctx->measured_runs] = run->real;
+  ctx->process_times[ctx->measured_runs] = run->time;
+  ctx->spaces[ctx->measured_runs] = run->space;
+  ctx->measured_runs++;
+
+  for (i = 0; i < NUM_OUTCOMES; i++)
+    if (outcomes[i].status == run->status)
+      break;
+
+  assert(i < NUM_OUTCOMES);
+  ctx->outcome_counts[i]++;
+}
+
+static int cmp_double(const void *p, const void *q) {
+  double a = *(const double *)p, b = *(const double *)q;
+  return (a > b) - (a < b);
+}
+
+/* Two-sided 95% quantiles of Student's t-distribution. */
+
+static double t_quantile(long degrees_of_freedom) {
+  static const double table[] = {
+      12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+      2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+      2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+  };
+  const long size = sizeof table / sizeof *table;
+  assert(degrees_of_freedom > 0);
+  if (degrees_of_freedom <= size)
+    return table[degrees_of_freedom - 1];
+  return 1.960;
+}
+
+/* Avoids including 'math.h' (which declares 'log') and linking 'libm'. */
+
+static double square_root(double x) {
+  double res, prev;
+  if (x <= 0)
+    return 0;
+  res = x > 1 ? x : 1;
+  do {
+    prev = res;
+    res = (res + x / res) / 2;
+  } while (res < prev);
+  return prev;
+}
+
+static double mean(const double *values, long n) {
+  double sum = 0;
+  long i;
+  assert(n > 0);
+  for (i = 0; i < n; i++)
+    sum += values[i];
+  return sum / n;
+}
+
+static double standard_deviation(const double *values, long n) {
+  double m, sum = 0;
+  long i;
+  if (n < 2)
+    return 0;
+  m = mean(values, n);
+  for (i = 0; i < n; i++)
+    sum += (values[i] - m) * (values[i] - m);
+  return square_root(sum / (n - 1));
+}
+
+static double confidence(const double *values, long n) {
+  if (n < 2)
+    return 0;
+  return t_quantile(n - 1) * standard_deviation(values, n) / square_root(n);
+}
+
+static double relative_confidence_width(const double *values, long n) {
+  double m = mean(values, n);
+  if (m <= 0)
+    return 0;
+  return 100 * 2 * confidence(values, n) / m;
+}
+
+static int confident(runlim_ctx *ctx) {
+  if (!ctx->repeat_ci || ctx->measured_runs < 3)
+    return 0;
+  if (relative_confidence_width(ctx->real_times,
+				ctx->measured_runs) >= ctx->repeat_ci)
+    return 0;
+  if (relative_confidence_width(ctx->process_times,
+				ctx->measured_runs) >= ctx->repeat_ci)
+    return 0;
+  return 1;
+}
+
+static void report_statistic(runlim_ctx *ctx, const char *type,
+			     const double *values, long n, const char *fmt,
+			     const char *unit) {
+  double *sorted, median, m, c;
+  char format[128];
+
+  assert(n > 0);
+
+  sorted = malloc(n * sizeof *sorted);
+  if (!sorted)
+    error(ctx, "out-of-memory allocating statistics");
+  memcpy(sorted, values, n * sizeof *sorted);
+  qsort(sorted, n, sizeof *sorted, cmp_double);
+
+  if (n & 1)
+    median = sorted[n / 2];
+  else
+    median = (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+
+  m = mean(values, n);
+  c = confidence(values, n);
+
+  sprintf(format,
+	  "%s min, %s median, %s mean, %s stddev, [%s, %s] 95%%%% confidence "
+	  "%s",
+	  fmt, fmt, fmt, fmt, fmt, fmt, unit);
+  message(ctx, type, format, sorted[0], median, m,
+	  standard_deviation(values, n), m - c, m + c);
+
+  free(sorted);
+}
+
+static void report_statistics(runlim_ctx *ctx, long runs) {
+  char histogram[1024];
+  const char *separator;
+  size_t i;
+
+  message(ctx, "runs", "%ld measured, %ld warmup", ctx->measured_runs,
+	  runs - ctx->measured_runs);
+
+  histogram[0] = 0;
+  separator = "";
+  for (i = 0; i < NUM_OUTCOMES; i++) {
+    if (!ctx->outcome_counts[i])
+      continue;
+    sprintf(histogram + strlen(histogram), "%s%ld %s", separator,
+	    ctx->outcome_counts[i], outcomes[i].description);
+    separator = ", ";
+  }
+  message(ctx, "statuses", "%s", histogram);
+
+  if (!ctx->measured_runs)
+    return;
+
+  report_statistic(ctx, "real statistics", ctx->real_times, ctx->measured_runs,
+		   "%.2f", "seconds");
+  report_statistic(ctx, "time statistics", ctx->process_times,
+		   ctx->measured_runs, "%.2f", "seconds");
+  report_statistic(ctx, "space statistics", ctx->spaces, ctx->measured_runs,
+		   "%.0f", "MB");
+}
+
+/*------------------------------------------------------------------------*/
+
+/* Resolve the program name in the same way as 'execvp' does, i.e., names
+ * containing a slash are used as they are and otherwise the directories
+ * in 'PATH' are searched for an executable regular file.  The result is
+ * stored in 'buffer'.
+ */
+
+static const char *resolve_executable(runlim_ctx *ctx, const char *name) {
+  const char *path, *p, *q;
+  struct stat buf;
+  size_t len;
+
+  if (strchr(name, '/'))
+    return name;
+
+  path = getenv("PATH");
+  if (!path)
+    path = "/bin:/usr/bin";
+
+  for (p = path;; p = q + 1) {
+    q = strchr(p, ':');
+    if (!q)
+      q = p + strlen(p);
+    ctx->pos_buffer = 0;
+    if (q == p)
+      push_buffer(ctx, '.');
+    for (const char *r = p; r < q; r++)
+      push_buffer(ctx, *r);
+    push_buffer(ctx, '/');
+    for (len = 0; name[len]; len++)
+      push_buffer(ctx, name[len]);
+    push_buffer(ctx, 0);
+    if (!stat(ctx->buffer, &buf) && S_ISREG(buf.st_mode) &&
+	!access(ctx->buffer, X_OK))
+      return ctx->buffer;
+    if (!*q)
+      return 0;
+  }
+}
+
+/*------------------------------------------------------------------------*/
+
+/* The files given with '--cold-cache=<files>' are evicted from the page
+ * cache before each run and those given with '--warm-cache=<files>' are
+ * read into it (both take comma separated lists).  For warm runs the
+ * executable and its shared libraries are read too.  The libraries are
+ * listed by the dynamic loader of 'runlim' itself in trace mode (as 'ldd'
+ * does), which maps them without running code of the program.  Unlike
+ * 'ldd' it neither uses the loader requested by the program nor a shell.
+ * The residency of the named files, i.e., the percentage of their pages in
+ * the page cache, is determined with 'mincore' and reported at the start
+ * and the end of each run.
+ */
+
+struct CachedFile {
+  char *path;
+  int warm;
+  double start;
+};
+
+static void add_cached_files(runlim_ctx *ctx, const char *list, int warm) {
+  const char *p, *q;
+  CachedFile *file;
+
+  for (p = list;; p = q + 1) {
+    q = strchr(p, ',');
+    if (!q)
+      q = p + strlen(p);
+    if (q > p) {
+      ctx->cached_files =
+	  realloc(ctx->cached_files,
+		  (ctx->num_cached_files + 1) * sizeof *ctx->cached_files);
+      if (!ctx->cached_files)
+	error(ctx, "out-of-memory allocating cached files");
+      file = ctx->cached_files + ctx->num_cached_files++;
+      file->path = strndup(p, q - p);
+      if (!file->path)
+	error(ctx, "out-of-memory allocating cached file");
+      file->warm = warm;
+      file->start = -1;
+    }
+    if (!*q)
+      break;
+  }
+}
+
+static void release_cached_files(runlim_ctx *ctx) {
+  size_t i;
+  for (i = 0; i < ctx->num_cached_files; i++)
+    free(ctx->cached_files[i].path);
+  free(ctx->cached_files);
+  ctx->cached_files = 0;
+  ctx->num_cached_files = 0;
 }
 
-static long read_all_processes(void) {
-  struct dirent *de;
-  long pid;
-  DIR *dir;
+// Percentage of pages of the file in the page cache or negative if the
+// file can not be mapped.
 
-  long res = 0;
+static double residency(runlim_ctx *ctx, const char *path) {
+  size_t pages, resident, i;
+  unsigned char *vector;
+  struct stat buf;
+  void *start;
+  int fd;
 
-  dir = opendir("/proc");
-  if (!dir) {
-    if (try_to_remount_proc_file_system())
-      dir = opendir("/proc");
-    if (!dir)
-      error("can not open directory '/proc'");
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  if (fstat(fd, &buf) || !S_ISREG(buf.st_mode)) {
+    (void)close(fd);
+    return -1;
   }
-
-  read_parent_status_and_mount_proc_file_system_if_necessary();
-
-  while ((de = readdir(dir)) != NULL) {
-    if (!is_positive_long(de->d_name, &pid))
-      continue;
-    if (pid <= 0)
-      continue;
-    if (pid == parent_pid)
-      continue;
-    if (read_process(pid))
-      res++;
+  if (!buf.st_size) {
+    (void)close(fd);
+    return 100;
   }
 
-  (void)closedir(dir);
-  debug("added", "%ld processes", res);
+  start = mmap(0, buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  (void)close(fd);
+  if (start == MAP_FAILED)
+    return -1;
 
-  return res;
-}
+  pages = (buf.st_size + ctx->page_size - 1) / ctx->page_size;
+  vector = malloc(pages);
+  resident = 0;
+  if (vector && !mincore(start, buf.st_size, vector))
+    for (i = 0; i < pages; i++)
+      resident += vector[i] & 1;
+  free(vector);
+  (void)munmap(start, buf.st_size);
 
-static long read_processes(void) {
-  if (single)
-    return read_process(child_pid);
-  else
-    return read_all_processes();
+  return 100.0 * resident / pages;
 }
 
-static void clear_tree_connections(Process *p) {
-  p->parent = p->first_child = p->last_child = p->next_sibbling = 0;
+static void evict_file(runlim_ctx *ctx, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    warning(ctx, "can not open '%s' to evict it from page cache", path);
+    return;
+  }
+  (void)fdatasync(fd);
+  if (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED))
+    warning(ctx, "can not evict '%s' from page cache", path);
+  (void)close(fd);
 }
 
-static void connect_process_tree(void) {
-  Process *p, *parent;
-  long connected = 0;
+static void warm_file(runlim_ctx *ctx, const char *path) {
+  char chunk[1 << 16];
+  struct stat buf;
+  int fd;
 
-  for (p = active_processes; p; p = p->next_process) {
-    assert(p->active);
-    assert(find_process(p->pid) == p);
-    parent = find_process(p->ppid);
-    clear_tree_connections(parent);
-    clear_tree_connections(p);
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    warning(ctx, "can not open '%s' to read it into page cache", path);
+    return;
   }
+  if (!fstat(fd, &buf))
+    (void)readahead(fd, 0, buf.st_size);
+  (void)close(fd);
 
-  for (p = active_processes; p; p = p->next_process) {
-    if (p->pid == child_pid)
-      continue;
-    assert(p->pid != parent_pid);
-    parent = find_process(p->ppid);
-    p->parent = parent;
-    if (parent->first_child) {
-      assert(parent->last_child);
-      assert(!parent->last_child->next_sibbling);
-      parent->last_child->next_sibbling = p;
-      parent->last_child = p;
-      assert(!p->next_sibbling);
-    } else {
-      assert(!parent->last_child);
-      parent->first_child = parent->last_child = p;
-      assert(!p->next_sibbling);
-    }
-    debug("connect", "%d -> %d", p->ppid, p->pid);
-    connected++;
-  }
+  // 'readahead' is only a hint, thus read the file if it is still not
+  // completely cached.
+
+  if (residency(ctx, path) >= 100)
+    return;
 
-  debug("connected", "%ld processes", connected);
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return;
+  while (read(fd, chunk, sizeof chunk) > 0)
+    ;
+  (void)close(fd);
 }
 
-/*------------------------------------------------------------------------*/
+// Reads the path of the dynamic loader (program interpreter) of 'runlim'.
 
-static double accumulated_time;
+static int read_dynamic_loader(char *path, size_t size) {
+  Elf64_Ehdr ehdr;
+  Elf64_Phdr phdr;
+  int fd, res = 0;
+  size_t i;
 
-/*------------------------------------------------------------------------*/
+  fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return 0;
 
-static long flush_inactive_processes(void) {
-  Process *prev = 0;
-  Process *next;
-  long res = 0;
-  Process *p;
+  if (pread(fd, &ehdr, sizeof ehdr, 0) == sizeof ehdr &&
+      !memcmp(ehdr.e_ident, ELFMAG, SELFMAG) &&
+      ehdr.e_ident[EI_CLASS] == ELFCLASS64)
+    for (i = 0; !res && i < ehdr.e_phnum; i++) {
+      if (pread(fd, &phdr, sizeof phdr, ehdr.e_phoff + i * sizeof phdr) !=
+	  sizeof phdr)
+	break;
+      if (phdr.p_type != PT_INTERP || !phdr.p_filesz ||
+	  phdr.p_filesz > size)
+	continue;
+      if (pread(fd, path, phdr.p_filesz, phdr.p_offset) !=
+	  (ssize_t)phdr.p_filesz)
+	break;
+      path[phdr.p_filesz - 1] = 0;
+      res = 1;
+    }
 
-  for (p = active_processes; p; p = next) {
-    assert(p->active);
+  (void)close(fd);
 
-    next = p->next_process;
+  return res;
+}
 
-    if (p->sampled == num_samples) {
-      prev = p;
-    } else {
-      p->active = 0;
+static void warm_libraries(runlim_ctx *ctx, const char *executable) {
+  char loader[PATH_MAX], line[PATH_MAX + 64], library[PATH_MAX];
+  int fds[2], status, null;
+  FILE *file;
+  pid_t pid;
 
-      if (prev)
-	prev->next_process = next;
-      else
-	active_processes = next;
+  if (!read_dynamic_loader(loader, sizeof loader))
+    return;
 
-      debug("deactive", "%d (%.3f sec)", p->pid, p->time);
-      accumulated_time += p->time;
-      p->next_process = 0;
-      res++;
-    }
+  if (pipe(fds))
+    return;
+
+  pid = fork();
+  if (pid < 0) {
+    (void)close(fds[0]);
+    (void)close(fds[1]);
+    return;
   }
 
-  last_active_process = prev;
+  if (!pid) {
+    null = open("/dev/null", O_WRONLY);
+    if (null >= 0)
+      (void)dup2(null, 2);
+    (void)dup2(fds[1], 1);
+    (void)close(fds[0]);
+    (void)close(fds[1]);
+    execl(loader, loader, "--list", executable, (char *)0);
+    _exit(1);
+  }
 
-  debug("flushed", "%ld processes", res);
+  (void)close(fds[1]);
+  file = fdopen(fds[0], "r");
+  if (file) {
+    while (fgets(line, sizeof line, file))
+      if (sscanf(line, " %*s => %4095s", library) == 1 ||
+	  sscanf(line, " %4095s (", library) == 1)
+	if (library[0] == '/') {
+	  debug(ctx, "warm", "library '%s'", library);
+	  warm_file(ctx, library);
+	}
+    fclose(file);
+  } else
+    (void)close(fds[0]);
 
-  return res;
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    ;
 }
 
-/*------------------------------------------------------------------------*/
-
-static double sampled_time;
-static double sampled_memory;
+static void warm_executable(runlim_ctx *ctx, char **program) {
+  const char *executable;
 
-/*------------------------------------------------------------------------*/
+  executable = resolve_executable(ctx, program[0]);
+  if (!executable)
+    return;
 
-static long sample_recursively(Process *p) {
-  const char *type;
-  Process *child;
-  long res = 0;
+  warm_file(ctx, executable);
+  warm_libraries(ctx, executable);
+}
 
-  if (p->cyclic_sampling) {
-    warning("cyclic process dependencies during sampling");
-    return 0;
-  }
+static void prepare_page_cache(runlim_ctx *ctx, char **program) {
+  int warm_program = 0;
+  CachedFile *file;
 
-  if (p->sampled == num_samples) {
-    if (p->new) {
-      children++;
-      type = "sampling (new)";
+  for (file = ctx->cached_files;
+       file < ctx->cached_files + ctx->num_cached_files; file++) {
+    if (file->warm) {
+      warm_file(ctx, file->path);
+      warm_program = 1;
     } else
-      type = "sampling";
-
-    sampled_time += p->time;
-    sampled_memory += p->memory;
-
-    res++;
-    debug(type, "%d (%.3f sec, %.3f MB)", p->pid, p->time, p->memory);
+      evict_file(ctx, file->path);
   }
 
-  p->cyclic_sampling = 1;
+  if (warm_program)
+    warm_executable(ctx, program);
 
-  for (child = p->first_child; child; child = child->next_sibbling)
-    res += sample_recursively(child);
+  for (file = ctx->cached_files;
+       file < ctx->cached_files + ctx->num_cached_files; file++)
+    file->start = residency(ctx, file->path);
+}
 
-  assert(p->cyclic_sampling);
-  p->cyclic_sampling = 0;
+static void report_page_cache(runlim_ctx *ctx) {
+  CachedFile *file;
+  double end;
 
-  return res;
+  for (file = ctx->cached_files;
+       file < ctx->cached_files + ctx->num_cached_files; file++) {
+    end = residency(ctx, file->path);
+    if (file->start < 0 || end < 0)
+      message(ctx, "residency", "unknown %s", file->path);
+    else
+      message(ctx, "residency", "%.0f%% at start, %.0f%% at end %s",
+	      file->start, end, file->path);
+  }
 }
 
 /*------------------------------------------------------------------------*/
 
-static struct itimerval timer;
-static struct itimerval old_timer;
+/* Results can be cached in a directory given by '--cache'.  Entries are
+ * keyed on a 128-bit FNV-1a hash of the contents of the executable, the
+ * arguments, the contents of arguments which name regular files, the
+ * environment variables selected with '--cache-env' and all options which
+ * change how the program is executed (process, thread and output limits,
+ * cores, I/O throttles, huge pages, address space layout randomization and
+ * environment settings).  The time, real time and space limits are only
+ * part of the key with the 'exact' cache policy.  Otherwise the limits of the
+ * cached run are stored with the entry and it is only reused if the
+ * result would be the same under the current limits.  With the default
+ * 'safe' policy this means that a completed run has to fit into the
+ * current limits and a run which exceeded a limit is only reused if the
+ * current limit is not larger.  The 'timeouts' policy reuses timeouts
+ * even under larger limits.
+ */
+
+#define CACHE_VERSION 2
 
-static volatile int caught_out_of_memory;
-static volatile int caught_out_of_time;
+enum { CACHE_EXACT, CACHE_SAFE, CACHE_TIMEOUTS };
 
-/*------------------------------------------------------------------------*/
+#define FNV_OFFSET                                                             \
+  (((Hash)0x6c62272e07bb0142ull << 64) | (Hash)0x62b821756295c58dull)
+#define FNV_PRIME (((Hash)0x0000000001000000ull << 64) | (Hash)0x13bull)
 
-static void term_process(Process *p) {
-  assert(p->pid != parent_pid);
-  debug("kill with SIGTERM ", "%d", p->pid);
-  kill(p->pid, SIGTERM);
+static void hash_bytes(runlim_ctx *ctx, const void *bytes, size_t size) {
+  const unsigned char *p = bytes, *end = p + size;
+  while (p < end) {
+    ctx->cache_key ^= *p++;
+    ctx->cache_key *= FNV_PRIME;
+  }
 }
 
-static void kill_process(Process *p) {
-  assert(p->pid != parent_pid);
-  debug("kill with SIGKILL ", "%d", p->pid);
-  kill(p->pid, SIGKILL);
+static void hash_string(runlim_ctx *ctx, const char *str) {
+  hash_bytes(ctx, str, strlen(str) + 1);
 }
 
-static long kill_recursively(Process *p, void (*killer)(Process *)) {
-  Process *child;
-  long res = 0;
+static void hash_number(runlim_ctx *ctx, double number) {
+  char str[32];
+  sprintf(str, "%.17g", number);
+  hash_string(ctx, str);
+}
 
-  if (p->cyclic_killing)
-    return 0;
+static void hash_names(runlim_ctx *ctx, Names *names) {
+  size_t i;
+  for (i = 0; i < names->count; i++)
+    hash_string(ctx, names->start[i]);
+  hash_string(ctx, "");
+}
 
-  p->cyclic_killing = 1;
-  for (child = p->first_child; child; child = child->next_sibbling)
-    res += kill_recursively(child, killer);
-  assert(p->cyclic_killing);
-  p->cyclic_killing = 0;
+static int hash_file(runlim_ctx *ctx, const char *path) {
+  char chunk[1 << 16];
+  size_t bytes;
+  FILE *file;
 
-  killer(p);
-  res++;
+  file = fopen(path, "r");
+  if (!file)
+    return 0;
+  while ((bytes = fread(chunk, 1, sizeof chunk, file)))
+    hash_bytes(ctx, chunk, bytes);
+  fclose(file);
 
-  return res;
+  return 1;
 }
 
-static int ancestor_in_same_session(Process *p) {
-  if (p->psession != session_pid)
-    return 0;
-  if (!single) {
-    assert(session_pid <= child_pid);
-    if (session_pid <= p->pid && p->pid < child_pid)
-      return 1;
+static void compute_cache_key(runlim_ctx *ctx, char **program) {
+  const char *executable, *value;
+  struct stat buf;
+  char **p;
+  size_t i;
+
+  ctx->cache_key = FNV_OFFSET;
+  hash_number(ctx, CACHE_VERSION);
+
+  executable = resolve_executable(ctx, program[0]);
+  if (!executable || !hash_file(ctx, executable))
+    error(ctx, "can not read executable '%s' for cache key", program[0]);
+  debug(ctx, "cache", "executable '%s'", executable);
+
+  for (p = program; *p; p++) {
+    hash_string(ctx, *p);
+    if (p != program && !stat(*p, &buf) && S_ISREG(buf.st_mode)) {
+      debug(ctx, "cache", "input file '%s'", *p);
+      if (!hash_file(ctx, *p))
+	error(ctx, "can not read input file '%s' for cache key", *p);
+    }
   }
-  return 0;
+  hash_string(ctx, "");
+
+  if (ctx->stdin_path) {
+    debug(ctx, "cache", "standard input file '%s'", ctx->stdin_path);
+    if (!hash_file(ctx, ctx->stdin_path))
+      error(ctx, "can not read standard input file '%s' for cache key",
+	    ctx->stdin_path);
+  }
+  hash_string(ctx, "");
+
+  for (i = 0; i < ctx->cache_env.count; i++) {
+    hash_string(ctx, ctx->cache_env.start[i]);
+    value = getenv(ctx->cache_env.start[i]);
+    if (value)
+      hash_string(ctx, value);
+    else
+      hash_bytes(ctx, "", 0);
+  }
+  hash_string(ctx, "");
+
+  if (ctx->soft_time_limit || ctx->soft_space_limit) {
+    hash_number(ctx, ctx->soft_time_limit);
+    hash_number(ctx, ctx->soft_space_limit);
+    hash_number(ctx, ctx->soft_signal);
+    hash_number(ctx, ctx->soft_fd);
+  }
+
+  hash_number(ctx, ctx->process_limit);
+  hash_number(ctx, ctx->thread_limit);
+  hash_number(ctx, ctx->output_limit);
+  hash_number(ctx, ctx->cores);
+  hash_number(ctx, ctx->cores_real_time);
+  hash_names(ctx, &ctx->io_max_specs);
+  hash_number(ctx, ctx->cgroup_parent != 0);
+  hash_number(ctx, ctx->single);
+  hash_number(ctx, ctx->swap_in_space);
+  hash_number(ctx, ctx->thp);
+  hash_number(ctx, ctx->no_aslr);
+  hash_number(ctx, ctx->clean_env);
+  hash_names(ctx, &ctx->keep_env);
+  hash_number(ctx, ctx->env_pad);
+
+  if (ctx->cache_policy == CACHE_EXACT) {
+    hash_number(ctx, ctx->time_limit);
+    hash_number(ctx, ctx->real_time_limit);
+    hash_number(ctx, ctx->space_limit);
+  }
+
+  sprintf(ctx->cache_name, "%016llx%016llx",
+	  (unsigned long long)(ctx->cache_key >> 64),
+	  (unsigned long long)ctx->cache_key);
 }
 
-static int ancestor_in_same_group(Process *p) {
-  if (p->pgrp != group_pid)
+/* Only statuses which are determined by the key and the time and space
+ * limits can be reused.  Runs which failed for other reasons are never
+ * stored, and entries with any other status are not trusted.
+ */
+
+static int reusable_cache_entry(runlim_ctx *ctx, Run *run,
+				double cached_time_limit,
+				double cached_real_time_limit,
+				double cached_space_limit) {
+  switch (run->status) {
+  case OK:
+  case OUT_OF_TIME:
+  case OUT_OF_MEMORY:
+  case SEGMENTATION_FAULT:
+  case BUS_ERROR:
+  case OTHER_SIGNAL:
+  case OUT_OF_OUTPUT:
+  case OUT_OF_PROCESSES:
+    break;
+  default:
     return 0;
-  if (!single) {
-    assert(group_pid <= child_pid);
-    if (group_pid <= p->pid && p->pid < child_pid)
+  }
+
+  if (ctx->cache_policy == CACHE_EXACT)
+    return 1;
+
+  if (run->status == OUT_OF_TIME) {
+    if (ctx->space_limit < run->space)
+      return 0;
+    if (ctx->cache_policy == CACHE_TIMEOUTS)
       return 1;
+    return ctx->time_limit <= cached_time_limit &&
+	   ctx->real_time_limit <= cached_real_time_limit;
   }
-  return 0;
-}
 
-static int is_root_zombie(Process *p) {
-  if (p->pid == child_pid)
-    return 0;
-  if (p->ppid == child_pid)
-    return 0;
-  if (ancestor_in_same_group(p))
+  if (run->time >= ctx->time_limit || run->real >= ctx->real_time_limit)
     return 0;
-  if (ancestor_in_same_session(p))
-    return 0;
-  Process *parent = find_process(p->ppid);
-  return parent->pgrp != group_pid && parent->psession != session_pid;
+
+  if (run->status == OUT_OF_MEMORY)
+    return ctx->space_limit <= cached_space_limit;
+
+  return run->space < ctx->space_limit;
 }
 
-static long kill_delay = KILL_DELAY;
+static int look_up_cache(runlim_ctx *ctx, char **program, Run *run) {
+  double cached_time_limit, cached_real_time_limit, cached_space_limit;
+  char path[PATH_MAX];
+  int version, status;
+  FILE *file;
+  int parsed;
 
-static void kill_all_child_processes(void) {
-  static void (*killer)(Process *);
-  long ms = kill_delay * 1000;
-  long rounds = 0;
-  Process *p;
-  long killed;
-  int ignore;
-  long read;
+  compute_cache_key(ctx, program);
+  snprintf(path, sizeof path, "%s/%s", ctx->cache_dir, ctx->cache_name);
 
-  assert(getpid() == parent_pid);
+  file = fopen(path, "r");
+  if (!file) {
+    message(ctx, "cache", "miss %s", ctx->cache_name);
+    return 0;
+  }
 
-  pthread_mutex_lock(&mutex);
-  if (!(ignore = killing))
-    killing = 1;
-  pthread_mutex_unlock(&mutex);
-  if (ignore)
-    return;
+  memset(run, 0, sizeof *run);
+  parsed = fscanf(file,
+		  "runlim-cache %d\n"
+		  "status %d\n"
+		  "result %d\n"
+		  "signal %d\n"
+		  "real %lf\n"
+		  "time %lf\n"
+		  "space %lf\n"
+		  "time-limit %lf\n"
+		  "real-time-limit %lf\n"
+		  "space-limit %lf\n"
+		  "description %31[^\n]\n",
+		  &version, &status, &run->result, &run->signal, &run->real,
+		  &run->time, &run->space, &cached_time_limit,
+		  &cached_real_time_limit, &cached_space_limit,
+		  run->description);
+  fclose(file);
 
-  debug("killing", "all child processes");
+  if (parsed != 11 || version != CACHE_VERSION) {
+    warning(ctx, "ignoring invalid cache entry '%s'", path);
+    return 0;
+  }
 
-  for (;;) {
-    if (ms >= 2000)
-      killer = term_process;
-    else
-      killer = kill_process;
+  run->status = status;
 
-    read = read_processes();
+  if (!reusable_cache_entry(ctx, run, cached_time_limit, cached_real_time_limit,
+			    cached_space_limit)) {
+    message(ctx, "cache", "stale %s", ctx->cache_name);
+    return 0;
+  }
 
-    killed = 0;
+  message(ctx, "cache", "hit %s", ctx->cache_name);
+  message(ctx, "status", "%s", run->description);
+  message(ctx, "result", "%d", run->result);
+  message(ctx, "real", "%.2f seconds", run->real);
+  message(ctx, "time", "%.2f seconds", run->time);
+  message(ctx, "space", "%.0f MB", run->space);
 
-    if (read > 0) {
-      connect_process_tree();
-      p = find_process(child_pid);
-      if (p->active)
-	killed = kill_recursively(p, killer);
+  return 1;
+}
 
-      for (p = active_processes; p; p = p->next_process)
-	if (p->active && is_root_zombie(p))
-	  killed += kill_recursively(p, killer);
-    }
+static void store_cache_entry(runlim_ctx *ctx, Run *run) {
+  char path[PATH_MAX], tmp[PATH_MAX];
+  FILE *file;
 
-    debug("killed", "%ld processes", killed);
+  switch (run->status) {
+  case FORK_FAILED:
+  case INTERNAL_ERROR:
+  case TERMINATED:
+  case EXEC_FAILED:
+    return;
+  default:
+    break;
+  }
 
-    if (!killed)
-      break;
-    if (ms <= 1000)
-      break;
+  snprintf(path, sizeof path, "%s/%s", ctx->cache_dir, ctx->cache_name);
+  snprintf(tmp, sizeof tmp, "%s/.%s.%ld", ctx->cache_dir, ctx->cache_name,
+	   ctx->supervisor);
 
-    rounds++;
+  file = fopen(tmp, "w");
+  if (!file) {
+    warning(ctx, "can not write cache entry '%s'", tmp);
+    return;
+  }
 
-    usleep(ms);
-    ms /= 2;
+  fprintf(file,
+	  "runlim-cache %d\n"
+	  "status %d\n"
+	  "result %d\n"
+	  "signal %d\n"
+	  "real %.6f\n"
+	  "time %.6f\n"
+	  "space %.6f\n"
+	  "time-limit %.0f\n"
+	  "real-time-limit %.0f\n"
+	  "space-limit %.0f\n"
+	  "description %s\n",
+	  CACHE_VERSION, (int)run->status, run->result, run->signal, run->real,
+	  run->time, run->space, ctx->time_limit, ctx->real_time_limit,
+	  ctx->space_limit, run->description);
+
+  if (fflush(file) || fsync(fileno(file))) {
+    fclose(file);
+    (void)unlink(tmp);
+    warning(ctx, "can not write cache entry '%s'", tmp);
+    return;
+  }
+
+  fclose(file);
+
+  if (rename(tmp, path)) {
+    (void)unlink(tmp);
+    warning(ctx, "can not rename cache entry '%s' to '%s'", tmp, path);
+    return;
   }
+
+  debug(ctx, "cache", "stored %s", path);
 }
 
 /*------------------------------------------------------------------------*/
 
-static double wall_clock_time(void) {
-  double res = -1;
-  struct timeval tv;
-  if (!gettimeofday(&tv, 0)) {
-    res = 1e-6 * tv.tv_usec;
-    res += tv.tv_sec;
+static void print_header(runlim_ctx *ctx, char **program) {
+  char system_thp[32];
+  char **p;
+
+  message(ctx, "version", "%s", VERSION);
+  message(ctx, "host", "%s", read_host_name(ctx));
+  message(ctx, "time limit", "%.0f seconds", ctx->time_limit);
+  message(ctx, "real time limit", "%.0f seconds", ctx->real_time_limit);
+  message(ctx, "space limit", "%.0f MB", ctx->space_limit);
+  if (ctx->process_limit)
+    message(ctx, "process limit", "%ld", ctx->process_limit);
+  if (ctx->thread_limit)
+    message(ctx, "thread limit", "%ld", ctx->thread_limit);
+  if (ctx->soft_time_limit)
+    message(ctx, "soft time limit", "%.0f seconds", ctx->soft_time_limit);
+  if (ctx->soft_space_limit)
+    message(ctx, "soft space limit", "%.0f MB", ctx->soft_space_limit);
+  if (ctx->soft_time_limit || ctx->soft_space_limit) {
+    message(ctx, "soft signal", "%d", ctx->soft_signal);
+    if (ctx->soft_fd >= 0)
+      message(ctx, "soft fd", "%d", ctx->soft_fd);
   }
-  return res;
+
+  for (p = program; *p; p++) {
+    char argstr[80];
+    sprintf(argstr, "argv[%ld]", (long)(p - program));
+    message(ctx, argstr, "%s", *p);
+  }
+
+  if (ctx->no_aslr)
+    message(ctx, "aslr", "disabled");
+  if (ctx->thp)
+    message(ctx, "thp", "%s (system %s%s)", thp_name(ctx),
+	    read_system_thp(ctx, system_thp, sizeof system_thp),
+	    thp_support(ctx));
+  if (ctx->environment)
+    message(ctx, "environment", "%zu variables, %zu bytes%s",
+	    ctx->environment_variables, ctx->environment_bytes,
+	    ctx->clean_env ? " (clean)" : "");
+
+  if (ctx->control_path)
+    message(ctx, "control", "%s", ctx->control_path);
 }
 
-static double tai_time(void) {
-  double res = -1;
-  struct timespec ts;
-  if (!clock_gettime(CLOCK_TAI, &ts)) {
-    res = 1e-9 * ts.tv_nsec;
-    res += ts.tv_sec;
+/* Executes the program once or repeatedly as requested, unless a cached
+ * result can be replayed, and leaves the result of the last run in 'run'.
+ */
+
+static void execute_program(runlim_ctx *ctx, char **program, Run *run) {
+  const long runs = ctx->warmup + ctx->repeat;
+  long k;
+
+  print_header(ctx, program);
+
+  if (ctx->cache_dir && look_up_cache(ctx, program, run))
+    return;
+
+  ctx->measured_runs = 0;
+  clear_outcomes(ctx);
+
+  for (k = 0; k < runs; k++) {
+    if (runs > 1) {
+      if (k < ctx->warmup)
+	message(ctx, "warmup", "%ld", k + 1);
+      else
+	message(ctx, "run", "%ld", k - ctx->warmup + 1);
+    }
+
+    if (ctx->num_cached_files)
+      prepare_page_cache(ctx, program);
+
+    run_program(ctx, program, run);
+
+    if (ctx->num_cached_files)
+      report_page_cache(ctx);
+
+    if (k >= ctx->warmup)
+      record_run(ctx, run);
+
+    if (ctx->caught_other_signal || ctx->terminate_requested)
+      break;
+    if (run->status == EXEC_FAILED || run->status == FORK_FAILED ||
+	run->status == INTERNAL_ERROR)
+      break;
+    if (k >= ctx->warmup && confident(ctx))
+      break;
   }
-  return res;
+
+  if (runs > 1)
+    report_statistics(ctx, k < runs ? k + 1 : k);
+
+  if (ctx->cache_dir && !ctx->caught_other_signal)
+    store_cache_entry(ctx, run);
 }
 
 /*------------------------------------------------------------------------*/
 
-static double real_time(void) {
-  double res;
-  if (start_time_tai < 0)
-    return -1;
-  res = tai_time() - start_time_tai;
+/* In queue mode ('--queue=<dir>') any number of workers, possibly on
+ * different hosts sharing the directory through a file system, take jobs
+ * from '<dir>/todo'.  A job is a file listing the program and its
+ * arguments, one per line.  It is claimed by renaming it to
+ * '<dir>/running', which is atomic, and the log of the run is written to
+ * '<job>.log' next to it.  Finished jobs and their logs are moved to
+ * '<dir>/done'.  While running a job the worker touches the job file
+ * regularly as heartbeat (from the sampler).  Running jobs without
+ * heartbeat for '--queue-timeout' seconds (which thus has to be larger
+ * than the heartbeat interval) are moved back to '<dir>/todo' when a
+ * worker runs out of jobs.  Time stamps are compared against the
+ * modification time of a freshly touched file in the queue directory,
+ * since the clocks of different hosts might differ.  The worker stops if
+ * there are no jobs left.
+ */
+
+static char *queue_path(runlim_ctx *ctx, const char *sub_dir, const char *name,
+			const char *suffix) {
+  size_t len = strlen(ctx->queue_dir) + strlen(sub_dir) + strlen(name) +
+	       strlen(suffix) + 3;
+  char *res = malloc(len);
+  if (!res)
+    error(ctx, "out-of-memory allocating queue path");
+  snprintf(res, len, "%s/%s/%s%s", ctx->queue_dir, sub_dir, name, suffix);
   return res;
 }
 
-/*------------------------------------------------------------------------*/
+static void init_queue(runlim_ctx *ctx) {
+  static const char *sub_dirs[] = {"todo", "running", "done"};
+  char path[PATH_MAX];
+  size_t i;
+  int fd;
 
-static void report(double time, double memory, double load) {
-  double real = real_time();
-  message("sample", "%.2f time, %.2f real, %.0f MB, %.2f load", time, real,
-	  memory, load);
-  num_reports++;
-}
+  for (i = 0; i < sizeof sub_dirs / sizeof *sub_dirs; i++) {
+    snprintf(path, sizeof path, "%s/%s", ctx->queue_dir, sub_dirs[i]);
+    if (mkdir(path, 0755) && errno != EEXIST)
+      error(ctx, "can not create queue directory '%s'", path);
+  }
 
-/*------------------------------------------------------------------------*/
+  snprintf(path, sizeof path, "%s/.clock.%s.%ld", ctx->queue_dir,
+	   read_host_name(ctx), ctx->supervisor);
+  ctx->queue_clock_path = strdup(path);
+  if (!ctx->queue_clock_path)
+    error(ctx, "out-of-memory allocating queue clock path");
 
-void print_process_tree(Process *p) {
-  Process *c;
-  debug("edge", "%d -> %d", p->ppid, p->pid);
-  for (c = p->first_child; c; c = c->next_sibbling)
-    print_process_tree(c);
+  fd = open(ctx->queue_clock_path, O_WRONLY | O_CREAT, 0644);
+  if (fd < 0)
+    error(ctx, "can not create queue clock file '%s'", ctx->queue_clock_path);
+  (void)close(fd);
 }
 
-/*------------------------------------------------------------------------*/
+static double queue_clock(runlim_ctx *ctx) {
+  struct stat buf;
+  if (utimensat(AT_FDCWD, ctx->queue_clock_path, 0, 0) ||
+      stat(ctx->queue_clock_path, &buf))
+    error(ctx, "can not access queue clock file '%s'", ctx->queue_clock_path);
+  return buf.st_mtim.tv_sec + 1e-9 * buf.st_mtim.tv_nsec;
+}
 
-static double sample_load(void) {
-  double load;
-  int res = getloadavg(&load, 1);
-  if (res != 1)
-    return 0;
-  if (load > max_load)
-    max_load = load;
-  return load;
+static int cmp_names(const void *p, const void *q) {
+  return strcmp(*(char *const *)p, *(char *const *)q);
 }
 
-/*------------------------------------------------------------------------*/
+static char **read_queue_directory(runlim_ctx *ctx, const char *sub_dir,
+				   size_t *count_ptr) {
+  char path[PATH_MAX], **res = 0;
+  size_t count = 0, size = 0;
+  struct dirent *de;
+  DIR *dir;
 
-static long sample_rate = SAMPLE_RATE;
-static long report_rate = REPORT_RATE;
+  snprintf(path, sizeof path, "%s/%s", ctx->queue_dir, sub_dir);
+  dir = opendir(path);
+  if (!dir)
+    error(ctx, "can not open queue directory '%s'", path);
 
-static void sample_all_child_processes(void) {
-  long sampled, read;
-  double load;
-  Process *p;
-  int ignore;
+  while ((de = readdir(dir)) != NULL) {
+    const char *name = de->d_name;
+    size_t len = strlen(name);
+    if (name[0] == '.')
+      continue;
+    if (len > 4 && !strcmp(name + len - 4, ".log"))
+      continue;
+    if (count == size) {
+      size = size ? 2 * size : 16;
+      res = realloc(res, size * sizeof *res);
+      if (!res)
+	error(ctx, "out-of-memory reading queue directory");
+    }
+    res[count] = strdup(name);
+    if (!res[count])
+      error(ctx, "out-of-memory reading queue directory");
+    count++;
+  }
 
-  assert(getpid() == parent_pid);
+  (void)closedir(dir);
 
-  pthread_mutex_lock(&mutex);
-  ignore = killing;
-  pthread_mutex_unlock(&mutex);
+  if (count)
+    qsort(res, count, sizeof *res, cmp_names);
 
-  if (ignore)
-    return;
+  *count_ptr = count;
+  return res;
+}
 
-  load = sample_load();
+static void release_queue_names(char **names, size_t count) {
+  size_t i;
+  for (i = 0; i < count; i++)
+    free(names[i]);
+  free(names);
+}
 
-  num_samples++;
+static char *claim_queue_job(runlim_ctx *ctx) {
+  char **names, *todo, *running, *res = 0;
+  size_t count, i;
 
-  read = read_processes();
-  connect_process_tree();
+  names = read_queue_directory(ctx, "todo", &count);
 
-  sampled_time = sampled_memory = 0;
+  for (i = 0; !res && i < count; i++) {
+    todo = queue_path(ctx, "todo", names[i], "");
+    running = queue_path(ctx, "running", names[i], "");
+    // Touch first, since 'rename' keeps the modification time.
+    if (!utimensat(AT_FDCWD, todo, 0, 0) && !rename(todo, running))
+      res = strdup(names[i]);
+    free(todo);
+    free(running);
+  }
 
-  if (read > 0) {
-    p = find_process(child_pid);
-    sampled = sample_recursively(p);
+  release_queue_names(names, count);
 
-    for (p = active_processes; p; p = p->next_process)
-      if (p->active && is_root_zombie(p))
-	sampled += sample_recursively(p);
-  } else
-    sampled = 0;
+  return res;
+}
 
-  debug("sampled", "%ld processes", sampled);
+static long requeue_stale_jobs(runlim_ctx *ctx) {
+  char **names, *todo, *running;
+  size_t count, i;
+  struct stat buf;
+  long res = 0;
+  double now;
+
+  now = queue_clock(ctx);
+  names = read_queue_directory(ctx, "running", &count);
+
+  for (i = 0; i < count; i++) {
+    running = queue_path(ctx, "running", names[i], "");
+    if (!stat(running, &buf) &&
+	now - buf.st_mtim.tv_sec > ctx->queue_timeout) {
+      todo = queue_path(ctx, "todo", names[i], "");
+      if (!rename(running, todo)) {
+	message(ctx, "requeue", "%s", names[i]);
+	res++;
+      }
+      free(todo);
+    }
+    free(running);
+  }
 
-  sampled += flush_inactive_processes();
-  sampled_time += accumulated_time;
+  release_queue_names(names, count);
 
-  if (sampled > 0) {
-    if (sampled_memory > max_memory)
-      max_memory = sampled_memory;
+  return res;
+}
 
-    if (sampled_time > max_time)
-      max_time = sampled_time;
-  }
+static char **read_queue_job(runlim_ctx *ctx, const char *path) {
+  size_t count = 0, size = 0;
+  char **res = 0;
+  FILE *file;
+  int ch;
 
-  if (++num_samples_since_last_report >= report_rate) {
-    num_samples_since_last_report = 0;
-    if (sampled > 0) {
-      print_process_tree(find_process(child_pid));
-      report(sampled_time, sampled_memory, load);
+  file = fopen(path, "r");
+  if (!file)
+    return 0;
+
+  for (;;) {
+    ch = getc(file);
+    if (ch == EOF)
+      break;
+    ctx->pos_buffer = 0;
+    while (ch != EOF && ch != '\n') {
+      push_buffer(ctx, ch);
+      ch = getc(file);
     }
+    push_buffer(ctx, 0);
+    if (count + 1 >= size) {
+      size = size ? 2 * size : 8;
+      res = realloc(res, size * sizeof *res);
+      if (!res)
+	error(ctx, "out-of-memory reading queue job");
+    }
+    res[count] = strdup(ctx->buffer);
+    if (!res[count])
+      error(ctx, "out-of-memory reading queue job");
+    count++;
   }
 
-  if (sampled > 0) {
-    if (sampled_time > time_limit || real_time() > real_time_limit) {
-      if (!caught_out_of_time) {
-	caught_out_of_time = 1;
-	kill_all_child_processes();
-      }
-    } else if (sampled_memory > space_limit) {
-      if (!caught_out_of_memory) {
-	caught_out_of_memory = 1;
-	kill_all_child_processes();
-      }
-    }
+  fclose(file);
+
+  if (!count) {
+    free(res);
+    return 0;
   }
-}
 
-static void alarm_handler_to_sample_all_children(int s) {
-  assert(s == SIGALRM);
-  sample_all_child_processes();
+  res[count] = 0;
+  return res;
 }
 
-/*------------------------------------------------------------------------*/
+static void work_on_queue(runlim_ctx *ctx, Run *run) {
+  char *name, *running, *running_log, *done, *done_log;
+  char **program, **p;
+  FILE *worker_log;
+  long jobs = 0;
 
-static volatile int caught_usr1_signal;
-static volatile int caught_other_signal;
+  init_queue(ctx);
+  message(ctx, "queue", "%s", ctx->queue_dir);
 
-static pthread_mutex_t caught_other_signal_mutex = PTHREAD_MUTEX_INITIALIZER;
+  while (!ctx->caught_other_signal && !ctx->terminate_requested) {
+    name = claim_queue_job(ctx);
+    if (!name && requeue_stale_jobs(ctx))
+      name = claim_queue_job(ctx);
+    if (!name)
+      break;
 
-/*------------------------------------------------------------------------*/
+    running = queue_path(ctx, "running", name, "");
+    running_log = queue_path(ctx, "running", name, ".log");
+    done = queue_path(ctx, "done", name, "");
+    done_log = queue_path(ctx, "done", name, ".log");
 
-static void sig_usr1_handler(int s) {
-  assert(s == SIGUSR1);
-  caught_usr1_signal = 1;
-}
+    program = read_queue_job(ctx, running);
+    worker_log = ctx->log;
 
-static void(*old_sig_int_handler);
-static void(*old_sig_segv_handler);
-static void(*old_sig_kill_handler);
-static void(*old_sig_term_handler);
-static void(*old_sig_abrt_handler);
+    if (!program)
+      warning(ctx, "invalid queue job '%s'", running);
+    else if (!(ctx->log = fopen(running_log, "w"))) {
+      ctx->log = worker_log;
+      warning(ctx, "can not write queue job log '%s'", running_log);
+    } else {
+      ctx->queue_heartbeat_path = running;
+      ctx->last_queue_heartbeat = 0;
+      execute_program(ctx, program, run);
+      ctx->queue_heartbeat_path = 0;
+      fclose(ctx->log);
+      ctx->log = worker_log;
+      (void)rename(running_log, done_log);
+      message(ctx, "job", "%s %s", name, run->description);
+      jobs++;
+    }
 
-static void restore_signal_handlers() {
-  (void)signal(SIGINT, old_sig_int_handler);
-  (void)signal(SIGSEGV, old_sig_segv_handler);
-  (void)signal(SIGKILL, old_sig_kill_handler);
-  (void)signal(SIGTERM, old_sig_term_handler);
-  (void)signal(SIGABRT, old_sig_abrt_handler);
-}
+    if (rename(running, done))
+      warning(ctx, "can not move queue job '%s' to '%s'", running, done);
 
-static void sig_other_handler(int s) {
-  int already_caught;
-  pthread_mutex_lock(&caught_other_signal_mutex);
-  already_caught = caught_other_signal;
-  caught_other_signal = 1;
-  pthread_mutex_unlock(&caught_other_signal_mutex);
-  if (already_caught)
-    return;
-  restore_signal_handlers();
-  kill_all_child_processes();
-  usleep(1000);
+    if (program) {
+      for (p = program; *p; p++)
+	free(*p);
+      free(program);
+    }
+
+    free(running);
+    free(running_log);
+    free(done);
+    free(done_log);
+    free(name);
+  }
+
+  message(ctx, "jobs", "%ld", jobs);
+
+  (void)unlink(ctx->queue_clock_path);
+  free(ctx->queue_clock_path);
+
+  memset(run, 0, sizeof *run);
+  strcpy(run->description, "ok");
 }
 
 /*------------------------------------------------------------------------*/
 
-static const char *ctime_without_new_line(time_t *t) {
-  const char *str, *p;
-  str = ctime(t);
-  pos_buffer = 0;
-  for (p = str; *p && *p != '\n'; p++)
-    push_buffer(*p);
-  push_buffer(0);
-  return buffer;
+/* Options are reset to their defaults before parsing, since the library
+ * might run several jobs in the same process.
+ */
+
+static void reset_options(runlim_ctx *ctx) {
+  ctx->log = stderr;
+  ctx->close_log = 0;
+  ctx->debug_messages = 0;
+  ctx->single = ctx->propagate_signals = ctx->propagate_exit_code = 0;
+  ctx->sample_rate = SAMPLE_RATE;
+  ctx->report_rate = REPORT_RATE;
+  ctx->kill_delay = KILL_DELAY;
+  ctx->status_page_dir = 0;
+  ctx->cpu_frequency = 0;
+  ctx->sysfs_root = "/sys";
+  ctx->thp = THP_NONE;
+  ctx->no_aslr = ctx->clean_env = 0;
+  ctx->env_pad = 0;
+  ctx->process_limit = ctx->thread_limit = 0;
+  ctx->cores = 0;
+  ctx->cores_real_time = 0;
+  ctx->io_accounting = 0;
+  ctx->swap = ctx->swap_in_space = 0;
+  ctx->breakdown = 0;
+  ctx->show_cmdline = 0;
+  ctx->energy = 0;
+  ctx->profile_path = 0;
+  ctx->thread_states = 0;
+  ctx->taskstats = 0;
+  ctx->contention = 0;
+  ctx->noisy_threshold = NOISY_THRESHOLD;
+  ctx->repeat = 1;
+  ctx->warmup = ctx->repeat_ci = 0;
+  ctx->cache_dir = 0;
+  ctx->cache_policy = CACHE_SAFE;
+  ctx->streams[0].path = ctx->streams[1].path = 0;
+  ctx->stdin_path = 0;
+  ctx->output_limit = 0;
+  ctx->queue_dir = 0;
+  ctx->queue_timeout = QUEUE_TIMEOUT;
+  ctx->cgroup_parent = 0;
+  ctx->control_path = 0;
+  ctx->soft_time_limit = ctx->soft_space_limit = 0;
+  ctx->soft_signal = SIGUSR2;
+  ctx->soft_fd = -1;
+  ctx->terminate_requested = 0;
+  ctx->caught_other_signal = 0;
+  ctx->informed = 0;
 }
 
-/*------------------------------------------------------------------------*/
+// Returns the position of the program in 'argv'.
 
-int main(int argc, char **argv) {
+static int parse_options(runlim_ctx *ctx, int argc, char **argv) {
   const char *log_name = 0, *tmp_name;
-  int i, j, res, status, s, ok;
-  char signal_description[80];
-  const char *description;
-  double real;
-  time_t t;
+  char io_max_line[128];
+  int i;
 
-  log = stderr;
-  assert(!close_log);
+  reset_options(ctx);
+  assert(!ctx->close_log);
 
   for (i = 1; i < argc; i++) {
     if (argv[i][0] == '-') {
@@ -1221,7 +7049,7 @@ int main(int argc, char **argv) {
       switch (argv[i][1]) {
       case 'o':
 	if (++i == argc)
-	  error("file argument to '-o' missing (try '-h')");
+	  error(ctx, "file argument to '-o' missing (try '-h')");
 	tmp_name = argv[i];
 	break;
 
@@ -1246,279 +7074,657 @@ int main(int argc, char **argv) {
       }
 
       if (log_name)
-	error("multiple output files '%s' and '%s'", log_name, tmp_name);
+	error(ctx, "multiple output files '%s' and '%s'", log_name, tmp_name);
 
       assert(tmp_name);
       log_name = tmp_name;
-      log = fopen(log_name, "w");
-      if (!log)
-	error("can not write output to '%s'", log_name);
-      close_log = 1;
+      ctx->log = fopen(log_name, "w");
+      if (!ctx->log)
+	error(ctx, "can not write output to '%s'", log_name);
+      ctx->close_log = 1;
     } else
       break;
   }
 
-  get_page_size();
-  get_physical_memory();
-  get_clock_ticks();
-
-  ok = OK; /* status of the runlim */
-  s = 0;   /* signal caught */
+  get_page_size(ctx);
+  get_physical_memory(ctx);
+  get_clock_ticks(ctx);
 
-  time_limit = 60 * 60 * 24 * 3600; /* one year */
-  real_time_limit = time_limit;	    /* same as time limit by default */
-  space_limit = physical_memory;
+  ctx->time_limit = 60 * 60 * 24 * 3600;  /* one year */
+  ctx->real_time_limit = ctx->time_limit; /* same as time limit by default */
+  ctx->space_limit = ctx->physical_memory;
 
   for (i = 1; i < argc; i++) {
     if (argv[i][0] == '-') {
       if (argv[i][1] == 'o') {
-	assert(close_log);
+	assert(ctx->close_log);
 	i++;
 	assert(i < argc);
       } else if (argv[i][1] == 't') {
-	time_limit = parse_number_argument(&i, argc, argv);
+	ctx->time_limit = parse_number_argument(ctx, &i, argc, argv);
       } else if (strstr(argv[i], "--time-limit=") == argv[i]) {
-	time_limit = parse_number_rhs(argv[i]);
+	ctx->time_limit = parse_number_rhs(ctx, argv[i]);
       } else if (argv[i][1] == 'r') {
-	real_time_limit = parse_number_argument(&i, argc, argv);
+	ctx->real_time_limit = parse_number_argument(ctx, &i, argc, argv);
       } else if (strstr(argv[i], "--output-file=") == argv[i]) {
-	assert(close_log);
+	assert(ctx->close_log);
       } else if (strstr(argv[i], "--real-time-limit=") == argv[i]) {
-	real_time_limit = parse_number_rhs(argv[i]);
+	ctx->real_time_limit = parse_number_rhs(ctx, argv[i]);
       } else if (argv[i][1] == 's') {
-	space_limit = parse_number_argument(&i, argc, argv);
+	ctx->space_limit = parse_number_argument(ctx, &i, argc, argv);
       } else if (strstr(argv[i], "--space-limit=") == argv[i]) {
-	space_limit = parse_number_rhs(argv[i]);
+	ctx->space_limit = parse_number_rhs(ctx, argv[i]);
+      } else if (strstr(argv[i], "--soft-time-limit=") == argv[i]) {
+	ctx->soft_time_limit = parse_number_rhs(ctx, argv[i]);
+      } else if (strstr(argv[i], "--soft-space-limit=") == argv[i]) {
+	ctx->soft_space_limit = parse_number_rhs(ctx, argv[i]);
+      } else if (strstr(argv[i], "--soft-signal=") == argv[i]) {
+	ctx->soft_signal = parse_number_rhs(ctx, argv[i]);
+	if (ctx->soft_signal >= NSIG)
+	  error(ctx, "invalid soft signal '%d'", ctx->soft_signal);
+      } else if (strstr(argv[i], "--soft-fd=") == argv[i]) {
+	ctx->soft_fd = parse_number_rhs(ctx, argv[i]);
+	if (ctx->soft_fd < 3)
+	  error(ctx, "invalid soft limit descriptor '%d'", ctx->soft_fd);
       } else if (strstr(argv[i], "--sample-rate=") == argv[i]) {
-	sample_rate = parse_number_rhs(argv[i]);
-	if (sample_rate <= 0)
-	  error("invalid sample rate '%ld'", sample_rate);
+	ctx->sample_rate = parse_number_rhs(ctx, argv[i]);
+	if (ctx->sample_rate <= 0)
+	  error(ctx, "invalid sample rate '%ld'", ctx->sample_rate);
       } else if (strstr(argv[i], "--report-rate=") == argv[i]) {
-	report_rate = parse_number_rhs(argv[i]);
-	if (report_rate <= 0)
-	  error("invalid report rate '%ld'", report_rate);
+	ctx->report_rate = parse_number_rhs(ctx, argv[i]);
+	if (ctx->report_rate <= 0)
+	  error(ctx, "invalid report rate '%ld'", ctx->report_rate);
       } else if (strstr(argv[i], "--kill-delay=") == argv[i]) {
-	kill_delay = parse_number_rhs(argv[i]);
-	if (kill_delay <= 0 || kill_delay >= 1e6)
-	  error("invalid kill delay '%ld'", kill_delay);
+	ctx->kill_delay = parse_number_rhs(ctx, argv[i]);
+	if (ctx->kill_delay <= 0 || ctx->kill_delay >= 1e6)
+	  error(ctx, "invalid kill delay '%ld'", ctx->kill_delay);
       } else if (strcmp(argv[i], "-v") == 0 ||
 		 strcmp(argv[i], "--version") == 0) {
+	if (!ctx->command_line)
+	  error(ctx, "'%s' not supported by library", argv[i]);
 	printf("%s\n", VERSION);
 	fflush(stdout);
-	exit(0);
+	ctx->informed = 1;
+	return i;
       } else if (strcmp(argv[i], "-d") == 0 ||
 		 strcmp(argv[i], "--debug") == 0) {
-	debug_messages = 1;
+	ctx->debug_messages = 1;
       } else if (strcmp(argv[i], "--single") == 0) {
-	single = 1;
+	ctx->single = 1;
       } else if (strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "--kill") == 0) {
-	propagate_signals = 1;
+	ctx->propagate_signals = 1;
       } else if (strcmp(argv[i], "-p") == 0 ||
 		 strcmp(argv[i], "--propagate") == 0) {
-	propagate_exit_code = 1;
+	ctx->propagate_exit_code = 1;
+      } else if (strcmp(argv[i], "--status-page") == 0) {
+	ctx->status_page_dir = STATUS_PAGE_DIR;
+      } else if (strstr(argv[i], "--status-page=") == argv[i]) {
+	ctx->status_page_dir = strchr(argv[i], '=') + 1;
+      } else if (strcmp(argv[i], "--frequency") == 0) {
+	ctx->cpu_frequency = 1;
+      } else if (strstr(argv[i], "--sysfs=") == argv[i]) {
+	ctx->sysfs_root = strchr(argv[i], '=') + 1;
+      } else if (strstr(argv[i], "--cold-cache=") == argv[i]) {
+	add_cached_files(ctx, strchr(argv[i], '=') + 1, 0);
+      } else if (strstr(argv[i], "--warm-cache=") == argv[i]) {
+	add_cached_files(ctx, strchr(argv[i], '=') + 1, 1);
+      } else if (strcmp(argv[i], "--thp=inherit") == 0) {
+	ctx->thp = THP_INHERIT;
+      } else if (strcmp(argv[i], "--thp=always") == 0) {
+	ctx->thp = THP_ALWAYS;
+      } else if (strcmp(argv[i], "--thp=never") == 0) {
+	ctx->thp = THP_NEVER;
+      } else if (strcmp(argv[i], "--no-aslr") == 0) {
+	ctx->no_aslr = 1;
+      } else if (strcmp(argv[i], "--clean-env") == 0) {
+	ctx->clean_env = 1;
+      } else if (strstr(argv[i], "--keep-env=") == argv[i]) {
+	push_name(ctx, &ctx->keep_env, strchr(argv[i], '=') + 1);
+      } else if (strstr(argv[i], "--env-pad=") == argv[i]) {
+	ctx->env_pad = parse_number_rhs(ctx, argv[i]);
+	if (ctx->env_pad <= 0)
+	  error(ctx, "invalid environment padding '%ld'", ctx->env_pad);
+      } else if (strstr(argv[i], "--max-processes=") == argv[i]) {
+	ctx->process_limit = parse_number_rhs(ctx, argv[i]);
+	if (ctx->process_limit <= 0)
+	  error(ctx, "invalid process limit '%ld'", ctx->process_limit);
+      } else if (strstr(argv[i], "--max-threads=") == argv[i]) {
+	ctx->thread_limit = parse_number_rhs(ctx, argv[i]);
+	if (ctx->thread_limit <= 0)
+	  error(ctx, "invalid thread limit '%ld'", ctx->thread_limit);
+      } else if (strstr(argv[i], "--cores=") == argv[i]) {
+	ctx->cores = parse_positive_double_rhs(ctx, argv[i]);
+      } else if (strcmp(argv[i], "--cores-real-time") == 0) {
+	ctx->cores_real_time = 1;
+      } else if (strcmp(argv[i], "--io") == 0) {
+	ctx->io_accounting = 1;
+      } else if (strstr(argv[i], "--io-max=") == argv[i]) {
+	if (!parse_io_max(strchr(argv[i], '=') + 1, io_max_line,
+			  sizeof io_max_line))
+	  error(ctx, "invalid device or limits in '%s'", argv[i]);
+	push_name(ctx, &ctx->io_max_specs, strchr(argv[i], '=') + 1);
+      } else if (strcmp(argv[i], "--swap") == 0) {
+	ctx->swap = 1;
+      } else if (strcmp(argv[i], "--swap-in-space") == 0) {
+	ctx->swap = ctx->swap_in_space = 1;
+      } else if (strcmp(argv[i], "--breakdown") == 0) {
+	ctx->breakdown = BREAKDOWN;
+      } else if (strstr(argv[i], "--breakdown=") == argv[i]) {
+	ctx->breakdown = parse_number_rhs(ctx, argv[i]);
+	if (ctx->breakdown <= 0)
+	  error(ctx, "invalid breakdown '%ld'", ctx->breakdown);
+      } else if (strcmp(argv[i], "--cmdline") == 0) {
+	ctx->show_cmdline = 1;
+      } else if (strcmp(argv[i], "--energy") == 0) {
+	ctx->energy = 1;
+      } else if (strstr(argv[i], "--profile=") == argv[i]) {
+	ctx->profile_path = strchr(argv[i], '=') + 1;
+	if (!*ctx->profile_path)
+	  error(ctx, "argument missing in '%s'", argv[i]);
+      } else if (strcmp(argv[i], "--thread-states") == 0) {
+	ctx->thread_states = 1;
+      } else if (strcmp(argv[i], "--taskstats") == 0) {
+	ctx->taskstats = 1;
+      } else if (strcmp(argv[i], "--contention") == 0) {
+	ctx->contention = 1;
+      } else if (strstr(argv[i], "--noisy-threshold=") == argv[i]) {
+	ctx->noisy_threshold = parse_number_rhs(ctx, argv[i]);
+      } else if (strstr(argv[i], "--repeat=") == argv[i]) {
+	ctx->repeat = parse_number_rhs(ctx, argv[i]);
+	if (ctx->repeat <= 0)
+	  error(ctx, "invalid number of repetitions '%ld'", ctx->repeat);
+      } else if (strstr(argv[i], "--warmup=") == argv[i]) {
+	ctx->warmup = parse_number_rhs(ctx, argv[i]);
+      } else if (strstr(argv[i], "--repeat-ci=") == argv[i]) {
+	ctx->repeat_ci = parse_number_rhs(ctx, argv[i]);
+      } else if (strstr(argv[i], "--cache=") == argv[i]) {
+	ctx->cache_dir = strchr(argv[i], '=') + 1;
+	if (!*ctx->cache_dir)
+	  error(ctx, "argument missing in '%s'", argv[i]);
+      } else if (strstr(argv[i], "--cache-env=") == argv[i]) {
+	push_name(ctx, &ctx->cache_env, strchr(argv[i], '=') + 1);
+      } else if (strcmp(argv[i], "--cache-policy=exact") == 0) {
+	ctx->cache_policy = CACHE_EXACT;
+      } else if (strcmp(argv[i], "--cache-policy=safe") == 0) {
+	ctx->cache_policy = CACHE_SAFE;
+      } else if (strcmp(argv[i], "--cache-policy=timeouts") == 0) {
+	ctx->cache_policy = CACHE_TIMEOUTS;
+      } else if (strstr(argv[i], "--stdout=") == argv[i]) {
+	ctx->streams[0].path = strchr(argv[i], '=') + 1;
+	if (!*ctx->streams[0].path)
+	  error(ctx, "argument missing in '%s'", argv[i]);
+      } else if (strstr(argv[i], "--stderr=") == argv[i]) {
+	ctx->streams[1].path = strchr(argv[i], '=') + 1;
+	if (!*ctx->streams[1].path)
+	  error(ctx, "argument missing in '%s'", argv[i]);
+      } else if (strstr(argv[i], "--stdin=") == argv[i]) {
+	ctx->stdin_path = strchr(argv[i], '=') + 1;
+	if (!*ctx->stdin_path)
+	  error(ctx, "argument missing in '%s'", argv[i]);
+      } else if (strstr(argv[i], "--output-limit=") == argv[i]) {
+	ctx->output_limit = parse_number_rhs(ctx, argv[i]);
+	if (ctx->output_limit <= 0)
+	  error(ctx, "invalid output limit '%s'", argv[i]);
+      } else if (strstr(argv[i], "--queue=") == argv[i]) {
+	ctx->queue_dir = strchr(argv[i], '=') + 1;
+	if (!*ctx->queue_dir)
+	  error(ctx, "argument missing in '%s'", argv[i]);
+      } else if (strstr(argv[i], "--queue-timeout=") == argv[i]) {
+	ctx->queue_timeout = parse_number_rhs(ctx, argv[i]);
+	if (ctx->queue_timeout <= 0)
+	  error(ctx, "invalid queue timeout '%ld'", ctx->queue_timeout);
+	if (ctx->queue_timeout <= QUEUE_HEARTBEAT)
+	  error(ctx, "queue timeout '%ld' not larger than heartbeat interval "
+		"(%d seconds)",
+		ctx->queue_timeout, QUEUE_HEARTBEAT);
+      } else if (strstr(argv[i], "--cgroup=") == argv[i]) {
+	ctx->cgroup_parent = strchr(argv[i], '=') + 1;
+	if (!*ctx->cgroup_parent)
+	  error(ctx, "argument missing in '%s'", argv[i]);
+      } else if (strstr(argv[i], "--control=") == argv[i]) {
+	ctx->control_path = strchr(argv[i], '=') + 1;
+	if (!*ctx->control_path)
+	  error(ctx, "argument missing in '%s'", argv[i]);
+      } else if (strcmp(argv[i], "--top") == 0) {
+	if (!ctx->command_line)
+	  error(ctx, "'%s' not supported by library", argv[i]);
+	top(ctx, STATUS_PAGE_DIR);
+	ctx->informed = 1;
+	return i;
+      } else if (strstr(argv[i], "--top=") == argv[i]) {
+	if (!ctx->command_line)
+	  error(ctx, "'%s' not supported by library", argv[i]);
+	top(ctx, strchr(argv[i], '=') + 1);
+	ctx->informed = 1;
+	return i;
       } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
-	usage();
-	exit(0);
+	if (!ctx->command_line)
+	  error(ctx, "'%s' not supported by library", argv[i]);
+	usage(ctx);
+	ctx->informed = 1;
+	return i;
       } else
-	error("invalid option '%s' (try '-h')", argv[1]);
+	error(ctx, "invalid option '%s' (try '-h')", argv[1]);
     } else
       break;
   }
 
-  if (i >= argc)
-    error("no program specified (try '-h')");
+  if (i >= argc && !ctx->queue_dir)
+    error(ctx, "no program specified (try '-h')");
 
-  message("version", "%s", VERSION);
-  message("host", "%s", read_host_name());
-  message("time limit", "%.0f seconds", time_limit);
-  message("real time limit", "%.0f seconds", real_time_limit);
-  message("space limit", "%.0f MB", space_limit);
+  if (i < argc && ctx->queue_dir)
+    error(ctx, "can not combine '--queue' with a program");
 
-  for (j = i; j < argc; j++) {
-    char argstr[80];
-    sprintf(argstr, "argv[%d]", j - i);
-    message(argstr, "%s", argv[j]);
+  if (ctx->cache_dir && (ctx->repeat > 1 || ctx->warmup))
+    error(ctx, "can not combine '--cache' with '--repeat' or '--warmup'");
+
+  if (ctx->io_max_specs.count && !ctx->cgroup_parent)
+    error(ctx, "'--io-max' requires '--cgroup'");
+
+  if (ctx->cores && !ctx->cgroup_parent)
+    error(ctx, "'--cores' requires '--cgroup'");
+
+  if (ctx->soft_time_limit && ctx->soft_time_limit >= ctx->time_limit)
+    error(ctx, "soft time limit not below time limit");
+
+  if (ctx->soft_space_limit && ctx->soft_space_limit >= ctx->space_limit)
+    error(ctx, "soft space limit not below space limit");
+
+  if (ctx->cores_real_time) {
+    if (!ctx->cores)
+      error(ctx, "'--cores-real-time' requires '--cores'");
+    if (ctx->time_limit / ctx->cores < ctx->real_time_limit)
+      ctx->real_time_limit = ctx->time_limit / ctx->cores;
   }
 
-  t = time(0);
-  message("start", "%s", ctime_without_new_line(&t));
+  if (ctx->clean_env || ctx->env_pad)
+    prepare_environment(ctx);
 
-  (void)signal(SIGUSR1, sig_usr1_handler);
+  if (ctx->show_cmdline && !ctx->breakdown)
+    ctx->breakdown = BREAKDOWN;
 
-  start_time_tai = tai_time();
-  start_time = wall_clock_time();
+  if (ctx->cache_dir &&
+      (ctx->streams[0].path || ctx->streams[1].path || ctx->profile_path))
+    error(ctx, "can not combine '--cache' with '--stdout', '--stderr' "
+	  "or '--profile'");
 
-  parent_pid = getpid();
-  group_pid = getpgid(0);
-  session_pid = getsid(0);
-  child_pid = fork();
+  return i;
+}
 
-  if (child_pid != 0) {
-    if (child_pid < 0) {
-      ok = FORK_FAILED;
-      res = 1;
-    } else {
-      status = 0;
+/* The command line tool keeps the program in its process group and
+ * session, such that for instance signals from the terminal reach it too.
+ * Jobs of the library run concurrently in the same process.  Thus there
+ * the program starts its own session (see 'run_program'), which separates
+ * the processes of different jobs.  Files and directories of a job are
+ * named after the identifier of the supervising thread, which is the
+ * process identifier for the command line tool.
+ */
 
-      old_sig_int_handler = signal(SIGINT, sig_other_handler);
-      old_sig_segv_handler = signal(SIGSEGV, sig_other_handler);
-      old_sig_kill_handler = signal(SIGKILL, sig_other_handler);
-      old_sig_term_handler = signal(SIGTERM, sig_other_handler);
-      old_sig_abrt_handler = signal(SIGABRT, sig_other_handler);
+static void start_supervision(runlim_ctx *ctx) {
+  if (ctx->control_path)
+    open_control_socket(ctx);
 
-      message("child", "%d", child_pid);
-      debug("group", "%d", group_pid);
-      debug("session", "%d", session_pid);
-      debug("parent", "%d", parent_pid);
+  ctx->parent_pid = getpid();
+  ctx->supervisor = syscall(SYS_gettid);
 
-      // The 'sampling' and killing of zombie processes relies on identifying
-      // group, session and other ancestor processes of the child process by
-      // comparing absolute numbers.  This assumes the following conditions.
+  if (ctx->command_line) {
+    ctx->group_pid = getpgid(0);
+    ctx->session_pid = getsid(0);
+  }
 
-      if (!single && group_pid > child_pid)
-	error("group pid %d larger than child pid %d", group_pid, child_pid);
+  if (ctx->control_path)
+    start_control_thread(ctx);
 
-      if (!single && session_pid > child_pid)
-	error("session pid %d larger than child pid %d", session_pid,
-	      child_pid);
+  ctx->real_times = malloc(ctx->repeat * sizeof *ctx->real_times);
+  ctx->process_times = malloc(ctx->repeat * sizeof *ctx->process_times);
+  ctx->spaces = malloc(ctx->repeat * sizeof *ctx->spaces);
+  ctx->outcome_counts = malloc(NUM_OUTCOMES * sizeof *ctx->outcome_counts);
+  if (!ctx->real_times || !ctx->process_times || !ctx->spaces ||
+      !ctx->outcome_counts)
+    error(ctx, "out-of-memory allocating run statistics");
+}
 
-      usleep(10000);
+static void stop_supervision(runlim_ctx *ctx) {
+  close_control_socket(ctx);
 
-      timer.it_interval.tv_sec = sample_rate / 1000000;
-      timer.it_interval.tv_usec = sample_rate % 1000000;
-      timer.it_value = timer.it_interval;
+  if (ctx->close_log) {
+    if (fclose(ctx->log))
+      fputs("runlim warning: could not close log file\n", stderr);
+    ctx->log = stderr;
+    ctx->close_log = 0;
+  }
 
-      signal(SIGALRM, alarm_handler_to_sample_all_children);
-      setitimer(ITIMER_REAL, &timer, &old_timer);
+  if (ctx->buffer)
+    free(ctx->buffer);
+  ctx->buffer = 0;
+  ctx->size_buffer = ctx->pos_buffer = 0;
+
+  free(ctx->real_times);
+  free(ctx->process_times);
+  free(ctx->spaces);
+  free(ctx->outcome_counts);
+  ctx->real_times = ctx->process_times = ctx->spaces = 0;
+  ctx->outcome_counts = 0;
+
+  release_names(&ctx->cache_env);
+  release_names(&ctx->io_max_specs);
+  release_names(&ctx->keep_env);
+  release_environment(ctx);
+  release_cached_files(ctx);
+  free(ctx->blockers);
+  ctx->blockers = 0;
+  ctx->num_blockers = ctx->size_blockers = 0;
+  free(ctx->zones);
+  ctx->zones = 0;
+  ctx->num_zones = ctx->zones_searched = 0;
+  ctx->energy_baseline = 0;
+
+  release_process_hash_table(ctx);
+}
 
-      (void)wait(&status);
+static void supervise(runlim_ctx *ctx, char **program, Run *run) {
+  start_supervision(ctx);
+  if (ctx->queue_dir)
+    work_on_queue(ctx, run);
+  else
+    execute_program(ctx, program, run);
+  stop_supervision(ctx);
+}
 
-      setitimer(ITIMER_REAL, &old_timer, &timer);
+/*------------------------------------------------------------------------*/
 
-      if (WIFEXITED(status))
-	res = WEXITSTATUS(status);
-      else if (WIFSIGNALED(status)) {
-	s = WTERMSIG(status);
-	res = 128 + s;
-	switch (s) {
-	case SIGXFSZ:
-	  ok = OUT_OF_MEMORY;
-	  break;
-	case SIGXCPU:
-	  ok = OUT_OF_TIME;
-	  break;
-	case SIGSEGV:
-	  ok = SEGMENTATION_FAULT;
-	  break;
-	case SIGBUS:
-	  ok = BUS_ERROR;
-	  break;
-	default:
-	  ok = OTHER_SIGNAL;
-	  break;
-	}
-      } else {
-	ok = INTERNAL_ERROR;
-	res = 1;
-      }
+/* Releases what an unfinished job of the library still holds after an
+ * error in the supervising thread.  Remaining processes are killed, the
+ * child is reaped and the sockets, files and the cgroup of the job are
+ * released.  Errors while killing are ignored.
+ */
+
+static void abort_run(runlim_ctx *ctx) {
+  sigjmp_buf *previous = recovery;
+  sigjmp_buf recover;
+  int status;
+
+  stop_sampler(ctx);
+
+  if (ctx->child_pid > 0 && !ctx->child_reaped) {
+    recovery = &recover;
+    if (!sigsetjmp(recover, 1))
+      run_under_sampler_mutex(ctx, kill_all_child_processes);
+    recovery = previous;
+    if (ctx->cgroup_path)
+      (void)write_cgroup_file(ctx, "cgroup.kill", "1\n");
+    (void)kill(ctx->child_pid, SIGKILL);
+    while (waitpid(ctx->child_pid, &status, 0) < 0 && errno == EINTR)
+      ;
+    ctx->child_reaped = 1;
+  }
+
+  close_streams(ctx);
+
+  if (ctx->soft_socket[0] >= 0)
+    (void)close(ctx->soft_socket[0]);
+  if (ctx->soft_socket[1] >= 0)
+    (void)close(ctx->soft_socket[1]);
+  ctx->soft_socket[0] = ctx->soft_socket[1] = -1;
+
+  stop_taskstats(ctx);
+  release_profile(ctx);
+  remove_cgroup(ctx);
+  close_status_page(ctx);
+  if (ctx->cpu_frequency)
+    release_frequency(ctx);
+}
+
+/* The sample callback is called from a separate thread, which blocks all
+ * signals and copies the last posted sample under the sampler mutex.
+ * Thus the callback may take locks, allocate memory and print.  Samples
+ * posted while the callback is still running are skipped.
+ */
+
+static void *callback_thread_main(void *ptr) {
+  runlim_ctx *ctx = ptr;
+  runlim_sample sample;
+  long posted, delivered = 0;
+
+  for (;;) {
+    while (sem_wait(&ctx->samples) && errno == EINTR)
+      ;
+    pthread_mutex_lock(&ctx->sampler_mutex);
+    sample = ctx->sample;
+    posted = ctx->posted;
+    pthread_mutex_unlock(&ctx->sampler_mutex);
+    if (posted != delivered) {
+      delivered = posted;
+      ctx->callback(ctx->data, &sample);
     }
-  } else {
-    execvp(argv[i], argv + i);
-    kill(getppid(), SIGUSR1); // TODO DOES THIS WORK?
-    exit(1);
+    if (ctx->stopping)
+      break;
   }
 
-  real = real_time();
+  return 0;
+}
 
-  if (caught_usr1_signal)
-    ok = EXEC_FAILED;
-  else if (caught_out_of_memory)
-    ok = OUT_OF_MEMORY;
-  else if (caught_out_of_time)
-    ok = OUT_OF_TIME;
+static int start_callback_thread(runlim_ctx *ctx) {
+  sigset_t all, old;
+  int res;
 
-  sample_all_child_processes();
-  kill_all_child_processes();
+  ctx->posted = 0;
+  ctx->stopping = 0;
 
-  t = time(0);
-  message("end", "%s", ctime_without_new_line(&t));
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  res = !pthread_create(&ctx->callback_thread, 0, callback_thread_main, ctx);
+  pthread_sigmask(SIG_SETMASK, &old, 0);
 
-  if (max_time >= time_limit || real_time() >= real_time_limit)
-    goto FORCE_OUT_OF_TIME_ENTRY;
+  return res;
+}
 
-  switch (ok) {
-  case OK:
-    description = "ok";
-    break;
-  case OUT_OF_TIME:
-  FORCE_OUT_OF_TIME_ENTRY:
-    description = "out of time";
-    res = 2;
-    break;
-  case OUT_OF_MEMORY:
-    description = "out of memory";
-    res = 3;
-    break;
-  case SEGMENTATION_FAULT:
-    description = "segmentation fault";
-    res = 4;
-    break;
-  case BUS_ERROR:
-    description = "bus error";
-    res = 5;
-    break;
-  case FORK_FAILED:
-    description = "fork failed";
-    res = 6;
-    break;
-  case INTERNAL_ERROR:
-    description = "internal error";
-    res = 7;
-    break;
-  case EXEC_FAILED:
-    description = "execvp failed";
-    res = 1;
-    break;
-  default:
-    sprintf(signal_description, "signal(%d)", s);
-    description = signal_description;
-    res = 11;
-    break;
+static void stop_callback_thread(runlim_ctx *ctx) {
+  ctx->stopping = 1;
+  (void)sem_post(&ctx->samples);
+  pthread_join(ctx->callback_thread, 0);
+}
+
+static void init_streams(runlim_ctx *ctx) {
+  static const char *names[NUM_STREAMS] = {"stdout", "stderr"};
+  Stream *stream;
+  int i;
+
+  for (i = 0; i < NUM_STREAMS; i++) {
+    stream = ctx->streams + i;
+    stream->ctx = ctx;
+    stream->name = names[i];
+    stream->fd = i + 1;
+    stream->pipe[0] = stream->pipe[1] = -1;
+    stream->file = stream->discard = -1;
   }
+}
 
-  message("status", description);
-  message("result", "%d", res);
-  message("children", "%d", children);
-  message("processes", "%d", processes);
-  message("real", "%.2f seconds", real);
-  message("time", "%.2f seconds", max_time);
-  message("space", "%.0f MB", max_memory);
-  message("load", "%.2f maximum", max_load);
-  message("samples", "%ld", num_samples);
-  debug("reports", "%ld", num_samples);
+runlim_ctx *runlim_new(void) {
+  pthread_condattr_t cond_attributes;
+  runlim_ctx *res;
 
-  if (ok == OK && !propagate_exit_code)
-    res = 0;
+  res = calloc(1, sizeof *res);
+  if (!res)
+    return 0;
+  if (sem_init(&res->samples, 0, 0)) {
+    free(res);
+    return 0;
+  }
+
+  pthread_mutex_init(&res->killing_mutex, 0);
+  pthread_mutex_init(&res->sampler_mutex, 0);
+  pthread_condattr_init(&cond_attributes);
+  pthread_condattr_setclock(&cond_attributes, CLOCK_MONOTONIC);
+  pthread_cond_init(&res->sampler_wakeup, &cond_attributes);
+  pthread_condattr_destroy(&cond_attributes);
+
+  res->log = stderr;
+  res->child_pid = res->parent_pid = -1;
+  res->group_pid = res->session_pid = -1;
+  res->child_reaped = 1;
+  res->soft_socket[0] = res->soft_socket[1] = -1;
+  res->taskstats_socket = -1;
+  res->control_socket = -1;
+  res->stdin_file = -1;
+  init_streams(res);
+
+  return res;
+}
+
+void runlim_on_sample(runlim_ctx *ctx, runlim_sample_callback callback,
+		      void *data) {
+  ctx->callback = callback;
+  ctx->data = data;
+}
 
-  if (close_log) {
-    log = stderr;
-    if (fclose(log))
-      warning("could not close log file");
+int runlim_run(runlim_ctx *ctx, int argc, char **argv,
+	       runlim_result *result) {
+  sigjmp_buf recover;
+  int callback;
+  Run run;
+  int i;
+
+  assert(!ctx->running);
+
+  callback = ctx->callback && start_callback_thread(ctx);
+
+  ctx->running = 1;
+  ctx->failed = 0;
+
+  recovery = &recover;
+  if (sigsetjmp(recover, 1)) {
+    abort_run(ctx);
+    stop_supervision(ctx);
+    recovery = 0;
+    ctx->running = 0;
+    if (callback)
+      stop_callback_thread(ctx);
+    return 1;
   }
 
-  if (buffer)
-    free(buffer);
+  memset(&run, 0, sizeof run);
+  i = parse_options(ctx, argc, argv);
+  if (ctx->informed)
+    stop_supervision(ctx);
+  else
+    supervise(ctx, argv + i, &run);
+
+  recovery = 0;
+  ctx->running = 0;
+  if (callback)
+    stop_callback_thread(ctx);
+
+  if (ctx->failed)
+    return 1;
+
+  memset(result, 0, sizeof *result);
+  result->status = run.status;
+  strcpy(result->description, run.description);
+  result->result = run.result;
+  result->signal = run.signal;
+  result->real = run.real;
+  result->time = run.time;
+  result->space = run.space;
+  result->samples = ctx->num_samples;
+
+  return 0;
+}
+
+void runlim_delete(runlim_ctx *ctx) {
+  assert(!ctx->running);
+  pthread_cond_destroy(&ctx->sampler_wakeup);
+  pthread_mutex_destroy(&ctx->sampler_mutex);
+  pthread_mutex_destroy(&ctx->killing_mutex);
+  sem_destroy(&ctx->samples);
+  free(ctx);
+}
+
+/*------------------------------------------------------------------------*/
+
+#ifndef RUNLIM_LIBRARY
+
+/* The command line tool kills the job before it dies itself if it is
+ * interrupted or terminated.  Its signal handler only flags the signal,
+ * which interrupts 'wait4' in 'run_program' where the job is then killed,
+ * and restores the original handlers, such that a second signal is fatal.
+ * After a crash ('SIGSEGV' or 'SIGABRT') the handler can not rely on the
+ * supervising thread and directly kills the child with 'kill', which is
+ * async-signal-safe.  The library never installs signal handlers.
+ */
+
+static runlim_ctx *signal_context;
+
+static struct sigaction old_sig_int_action;
+static struct sigaction old_sig_segv_action;
+static struct sigaction old_sig_term_action;
+static struct sigaction old_sig_abrt_action;
+
+static void restore_signal_handlers(void) {
+  (void)sigaction(SIGINT, &old_sig_int_action, 0);
+  (void)sigaction(SIGSEGV, &old_sig_segv_action, 0);
+  (void)sigaction(SIGTERM, &old_sig_term_action, 0);
+  (void)sigaction(SIGABRT, &old_sig_abrt_action, 0);
+}
+
+static void sig_other_handler(int s) {
+  runlim_ctx *ctx = signal_context;
+  if (ctx->caught_other_signal)
+    return;
+  ctx->caught_other_signal = 1;
+  restore_signal_handlers();
+  if ((s == SIGSEGV || s == SIGABRT) && ctx->child_pid > 0 &&
+      !ctx->child_reaped)
+    (void)kill(ctx->child_pid, SIGKILL);
+}
 
-  if (process_hash_table) {
-    for (size_t pos = 0; pos < size_of_process_hash_table; pos++)
-      if (process_hash_table[pos])
-	free(process_hash_table[pos]);
+static void install_signal_handlers(runlim_ctx *ctx) {
+  struct sigaction action;
+  signal_context = ctx;
+  memset(&action, 0, sizeof action);
+  action.sa_handler = sig_other_handler;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = 0; // no 'SA_RESTART' to interrupt 'wait4'
+  (void)sigaction(SIGINT, &action, &old_sig_int_action);
+  (void)sigaction(SIGSEGV, &action, &old_sig_segv_action);
+  (void)sigaction(SIGTERM, &action, &old_sig_term_action);
+  (void)sigaction(SIGABRT, &action, &old_sig_abrt_action);
+}
 
-    free(process_hash_table);
+int main(int argc, char **argv) {
+  runlim_result result;
+  runlim_ctx *ctx;
+  int failed, informed, propagate_signals, propagate_exit_code;
+  int res, s, ok;
+
+  ctx = runlim_new();
+  if (!ctx) {
+    fputs("runlim error: out-of-memory allocating context\n", stderr);
+    return 1;
   }
 
+  ctx->command_line = 1;
+  install_signal_handlers(ctx);
+  failed = runlim_run(ctx, argc, argv, &result);
   restore_signal_handlers();
 
+  informed = ctx->informed;
+  propagate_signals = ctx->propagate_signals;
+  propagate_exit_code = ctx->propagate_exit_code;
+  runlim_delete(ctx);
+
+  if (failed)
+    return 1;
+  if (informed)
+    return 0;
+
+  ok = result.status;
+  res = result.result;
+  s = result.signal;
+
+  if (ok == OK && !propagate_exit_code)
+    res = 0;
+
   if (propagate_signals) {
     switch (ok) {
     case OK:
@@ -1527,6 +7733,9 @@ int main(int argc, char **argv) {
     case FORK_FAILED:
     case INTERNAL_ERROR:
     case EXEC_FAILED:
+    case TERMINATED:
+    case OUT_OF_OUTPUT:
+    case OUT_OF_PROCESSES:
       break;
     default:
       raise(s);
@@ -1536,3 +7745,5 @@ int main(int argc, char **argv) {
 
   return res;
 }
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef RUNLIM_H_INCLUDED
+#define RUNLIM_H_INCLUDED
+
+/* Library interface of 'runlim' ('librunlim.a', link with '-lpthread').
+ *
+ * A context runs jobs exactly as the command line tool does, taking the
+ * same options, and reports each sample through a callback and the outcome
+ * in a result structure instead of requiring to parse the log.  Messages
+ * still go to '<stderr>' (or '--output-file=<file>').
+ *
+ * Each context keeps all the state of its jobs, i.e., limits, statistics,
+ * the process table, streams and the cgroup, and samples from its own
+ * thread.  Thus contexts can run jobs concurrently in different threads
+ * of the same process, while each context runs one job at a time.  The
+ * library does not install signal handlers.  The program runs in its own
+ * session and is reaped by 'runlim_run', so the caller must neither reap
+ * children it did not fork itself nor ignore 'SIGCHLD'.
+ *
+ * The sample callback is called from a separate thread of the library
+ * (never concurrently with itself and skipping samples posted while it
+ * still runs).  After an error the job is killed and its resources are
+ * released before 'runlim_run' returns.
+ */
+
+typedef struct runlim_ctx runlim_ctx;
+typedef struct runlim_sample runlim_sample;
+typedef struct runlim_result runlim_result;
+
+struct runlim_sample {
+  long sample;    /* number of sample */
+  double real;    /* real time in seconds */
+  double time;    /* process time in seconds */
+  double space;   /* memory in MB */
+  double load;    /* system load */
+  long processes; /* sampled processes */
+  long threads;   /* sampled threads */
+};
+
+struct runlim_result {
+  int status;           /* 0 = ok, 1 = out of time, 2 = out of memory, ... */
+  char description[32]; /* as in '[runlim] status:' */
+  int result;           /* as in '[runlim] result:' */
+  int signal;           /* signal which terminated the program or zero */
+  double real;          /* real time in seconds */
+  double time;          /* process time in seconds */
+  double space;         /* maximum memory in MB */
+  long samples;         /* number of samples */
+};
+
+typedef void (*runlim_sample_callback)(void *data, const runlim_sample *);
+
+/* Returns zero if out of memory.
+ */
+runlim_ctx *runlim_new(void);
+
+void runlim_on_sample(runlim_ctx *, runlim_sample_callback, void *data);
+
+/* The arguments are those of the command line tool, i.e., 'argv[0]' is
+ * ignored, followed by options and the program with its arguments (or
+ * '--queue=<dir>').  Returns zero if the job was run (or replayed from
+ * the cache) and the result is filled, and non-zero after an error in
+ * which case the message was already printed.  Options which print
+ * information and exit ('-h', '-v' and '--top') are errors.
+ */
+int runlim_run(runlim_ctx *, int argc, char **argv, runlim_result *);
+
+void runlim_delete(runlim_ctx *);
+
+#endif